@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fat_traits.h"
+
+// Chain walk as Disk did it before FAT variant specialization: limits are runtime fields
+// and every entry is decoded by byte loop with multiplication table
+namespace runtime {
+const std::uint32_t BYTE = 256;
+const std::uint32_t WORD = BYTE * BYTE;
+const std::uint32_t MULS[] = {1, BYTE, WORD, WORD * BYTE};
+
+std::uint64_t extract_with_endian(std::string const& s, int from, int amount) {
+    std::uint64_t result = 0;
+    for (int i = 0; i < amount; i++) {
+        result += static_cast<unsigned char>(s[from + i]) * MULS[i];
+    }
+    return result;
+}
+
+struct Disk_fields {
+    std::uint32_t FAT_CLASTER_MIN;
+    std::uint32_t FAT_CLASTER_MAX;
+    std::uint32_t FAT_BAD;
+    std::uint32_t FAT_EOC_MIN;
+    std::uint32_t FAT_EOC_MAX;
+    std::uint32_t FAT_INDEX_LEN;
+    std::uint32_t COUNT_OF_CLUSTERS;
+};
+
+std::vector<std::uint32_t> get_claster_chain(Disk_fields const& disk, std::string const& fat, std::uint32_t start) {
+    std::uint32_t current = start;
+    std::vector<std::uint32_t> chain;
+    while (disk.FAT_CLASTER_MIN <= current && current <= std::min(disk.FAT_CLASTER_MAX, disk.COUNT_OF_CLUSTERS + 1)) {
+        if (current > disk.COUNT_OF_CLUSTERS + 1 || current > disk.FAT_CLASTER_MAX || current < disk.FAT_CLASTER_MIN) {
+            throw std::string("Current claster index is out of range");
+        }
+        chain.push_back(current);
+        current = extract_with_endian(fat, current * disk.FAT_INDEX_LEN, disk.FAT_INDEX_LEN);
+    }
+    if (current == disk.FAT_BAD || !(disk.FAT_EOC_MIN <= current && current <= disk.FAT_EOC_MAX)) {
+        throw std::string("Chain of clusters is broken");
+    }
+    return chain;
+}
+}
+
+// One chain over all clusters, stride 1 gives contiguous file, large prime stride makes every link jump far away
+template <class Traits>
+std::string make_fat(std::uint32_t clusters, std::uint32_t stride) {
+    std::string fat(Traits::entry_offset(clusters + 2) + 4, '\0');
+    std::uint32_t current = 2;
+    for (std::uint32_t i = 1; i < clusters; i++) {
+        std::uint32_t next = 2 + static_cast<std::uint32_t>((static_cast<std::uint64_t>(i) * stride) % clusters);
+        for (int b = 0; b < static_cast<int>(Traits::ENTRY_BITS / 8); b++) {
+            fat[Traits::entry_offset(current) + b] = static_cast<char>((next >> (8 * b)) & 0xFF);
+        }
+        current = next;
+    }
+    for (int b = 0; b < static_cast<int>(Traits::ENTRY_BITS / 8); b++) {
+        fat[Traits::entry_offset(current) + b] = static_cast<char>((Traits::EOC_MAX >> (8 * b)) & 0xFF);
+    }
+    return fat;
+}
+
+template <class F>
+double best_of(int rounds, F&& f) {
+    double best = 1e100;
+    for (int r = 0; r < rounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+template <class Traits>
+void bench(std::string const& title, std::uint32_t clusters, std::uint32_t stride, int rounds) {
+    std::string fat = make_fat<Traits>(clusters, stride);
+    volatile std::uint32_t index_len = Traits::ENTRY_BITS / 8;
+    runtime::Disk_fields disk = {Traits::CLASTER_MIN, Traits::CLASTER_MAX, Traits::BAD,
+                                 Traits::EOC_MIN, Traits::EOC_MAX, index_len, clusters};
+
+    std::size_t runtime_links = 0, specialized_links = 0;
+    double runtime_time = best_of(rounds, [&] {
+        runtime_links = runtime::get_claster_chain(disk, fat, 2).size();
+    });
+    double specialized_time = best_of(rounds, [&] {
+        std::vector<std::uint32_t> chain;
+        std::uint32_t end = 0;
+        if (FAT::walk_claster_chain<Traits>(fat, clusters, 2, chain, end) != FAT::Chain_status::OK) {
+            throw std::string("Chain of clusters is broken");
+        }
+        specialized_links = chain.size();
+    });
+    if (runtime_links != specialized_links) {
+        throw std::string("Walkers disagree on chain length");
+    }
+
+    std::cout << title << " : " << specialized_links << " links" << std::endl;
+    std::cout << "\truntime fields    " << runtime_time * 1e9 / runtime_links << " ns/link" << std::endl;
+    std::cout << "\tspecialized       " << specialized_time * 1e9 / specialized_links << " ns/link" << std::endl;
+    std::cout << "\tspeedup           " << runtime_time / specialized_time << "x" << std::endl;
+}
+
+int main() {
+    try {
+        bench<FAT::FAT16_traits>("FAT16 contiguous", 65000, 1, 50);
+        bench<FAT::FAT16_traits>("FAT16 fragmented", 65000, 7919, 50);
+        bench<FAT::FAT32_traits>("FAT32 contiguous", 4000000, 1, 10);
+        bench<FAT::FAT32_traits>("FAT32 fragmented", 4000000, 7919, 10);
+    } catch (std::string err) {
+        std::cerr << err << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,213 @@
+#define FUSE_USE_VERSION 31
+
+#include <fuse.h>
+
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fat.h"
+
+// Read-only FUSE frontend: fatfuse [image] [mountpoint] [fuse options]
+
+FAT::Disk disk;
+
+// Open handles are shared by first claster and size, so chain of file is walked once however many
+// times it is opened. Entry is dropped when the last descriptor of the file is released
+std::mutex handles_mutex;
+std::map<std::pair<std::uint32_t, std::uint64_t>, std::weak_ptr<const FAT::File_handle>> handles;
+
+std::pair<std::uint32_t, std::uint64_t> handle_key(FAT::File_info const& file) {
+    return {file.claster_index, file.size};
+}
+
+bool is_listed(FAT::File_info const& file) {
+    if (file.is_deleted || file.attr == 0x0f || file.attr & 0x08) return false;
+    return file.name_no_whitespace != "." && file.name_no_whitespace != "..";
+}
+
+bool find_entry(FAT::Folder const& folder, std::string const& name, FAT::File_info &file) {
+    FAT::File_info key;
+    key.name_key = to_lower_case(name);
+    auto range = std::equal_range(folder.files.begin(), folder.files.end(), key, FAT::Disk::cmp_files_name);
+    for (auto it = range.first; it != range.second; it++) {
+        if (!is_listed(*it)) continue;
+        file = *it;
+        return true;
+    }
+    return false;
+}
+
+// Resolves path through cached folders, root is reported as folder entry with claster 0
+int resolve(std::string const& path, FAT::File_info &file) {
+    file = FAT::File_info();
+    file.is_folder = true;
+    std::string atom;
+    std::stringstream ss(path);
+    while (std::getline(ss, atom, '/')) {
+        if (atom == "") continue;
+        if (!file.is_folder) return -ENOTDIR;
+        if (!find_entry(*disk.get_folder(file.claster_index), atom, file)) return -ENOENT;
+    }
+    return 0;
+}
+
+time_t modify_time(FAT::File_info const& file) {
+    std::tm tm = {};
+    tm.tm_year = file.year_modify - 1900;
+    tm.tm_mon = file.month_modify;
+    tm.tm_mday = file.day_modify;
+    tm.tm_hour = file.hour_modify;
+    tm.tm_min = file.minute_modify;
+    tm.tm_sec = file.second_modify;
+    tm.tm_isdst = -1;
+    return file.date_modify == 0 ? 0 : std::mktime(&tm);
+}
+
+void fill_stat(FAT::File_info const& file, struct stat *st) {
+    std::memset(st, 0, sizeof(*st));
+    if (file.is_folder) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+    } else {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = file.size;
+        st->st_blocks = (file.size + 511) / 512;
+    }
+    st->st_mtime = st->st_atime = st->st_ctime = modify_time(file);
+}
+
+// Exceptions of Disk are std::string, FUSE callbacks must turn them into errno
+template <class F>
+int guarded(F&& f) {
+    try {
+        return f();
+    } catch (std::string err) {
+        std::cerr << err << std::endl;
+        return -EIO;
+    } catch (...) {
+        return -EIO;
+    }
+}
+
+int fat_getattr(const char *path, struct stat *st, struct fuse_file_info *) {
+    return guarded([&] {
+        FAT::File_info file;
+        int result = resolve(path, file);
+        if (result == 0) fill_stat(file, st);
+        return result;
+    });
+}
+
+int fat_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info *,
+                enum fuse_readdir_flags) {
+    return guarded([&] {
+        FAT::File_info dir;
+        int result = resolve(path, dir);
+        if (result != 0) return result;
+        if (!dir.is_folder) return -ENOTDIR;
+        auto folder = disk.get_folder(dir.claster_index);
+        filler(buf, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+        filler(buf, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+        for (auto const& file : folder->files) {
+            if (!is_listed(file)) continue;
+            struct stat st;
+            fill_stat(file, &st);
+            if (filler(buf, FAT::Disk::get_file_show_name(file).c_str(), &st, 0, static_cast<fuse_fill_dir_flags>(0))) break;
+        }
+        return 0;
+    });
+}
+
+int fat_open(const char *path, struct fuse_file_info *fi) {
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EROFS;
+    return guarded([&] {
+        FAT::File_info file;
+        int result = resolve(path, file);
+        if (result != 0) return result;
+        if (file.is_folder) return -EISDIR;
+
+        auto key = handle_key(file);
+        std::shared_ptr<const FAT::File_handle> handle;
+        {
+            std::lock_guard<std::mutex> lock(handles_mutex);
+            auto cached = handles.find(key);
+            if (cached != handles.end()) handle = cached->second.lock();
+        }
+        if (!handle) {
+            handle = std::make_shared<const FAT::File_handle>(disk.open_file(file));
+            std::lock_guard<std::mutex> lock(handles_mutex);
+            handles[key] = handle;
+        }
+        fi->fh = reinterpret_cast<std::uint64_t>(new std::shared_ptr<const FAT::File_handle>(std::move(handle)));
+        fi->keep_cache = 1;
+        return 0;
+    });
+}
+
+// Reads only clusters covering [offset, offset + size), one pread per touched extent
+int fat_read(const char *, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    auto const& handle = *reinterpret_cast<std::shared_ptr<const FAT::File_handle>*>(fi->fh);
+    return guarded([&] {
+        if (offset < 0) return 0;
+        std::string data;
+        data.reserve(size);
+        std::uint64_t done = handle->read(offset, size, data);
+        std::memcpy(buf, data.data(), done);
+        return static_cast<int>(done);
+    });
+}
+
+int fat_release(const char *, struct fuse_file_info *fi) {
+    auto handle = reinterpret_cast<std::shared_ptr<const FAT::File_handle>*>(fi->fh);
+    auto key = handle_key((*handle)->get_file_info());
+    delete handle;
+    std::lock_guard<std::mutex> lock(handles_mutex);
+    auto cached = handles.find(key);
+    if (cached != handles.end() && cached->second.expired()) handles.erase(cached);
+    return 0;
+}
+
+void* fat_init(struct fuse_conn_info *, struct fuse_config *cfg) {
+    cfg->kernel_cache = 1;
+    cfg->use_ino = 0;
+    return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage : " << argv[0] << " [image] [mountpoint] [fuse options]" << std::endl;
+        return 1;
+    }
+    try {
+        disk.mount(argv[1]);
+        disk.get_folder(0);
+    } catch (std::string err) {
+        std::cerr << err << std::endl;
+        return 1;
+    }
+
+    fuse_operations operations = {};
+    operations.getattr = fat_getattr;
+    operations.readdir = fat_readdir;
+    operations.open = fat_open;
+    operations.read = fat_read;
+    operations.release = fat_release;
+    operations.init = fat_init;
+
+    std::vector<char*> fuse_argv = {argv[0]};
+    for (int i = 2; i < argc; i++) {
+        fuse_argv.push_back(argv[i]);
+    }
+    fuse_argv.push_back(const_cast<char*>("-o"));
+    fuse_argv.push_back(const_cast<char*>("ro"));
+    return fuse_main(static_cast<int>(fuse_argv.size()), fuse_argv.data(), &operations, nullptr);
+}
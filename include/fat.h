@@ -0,0 +1,1291 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <filesystem>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "fat_traits.h"
+
+inline void append_utf8(std::string &s, std::uint32_t code) {
+    if (code < 0x80) {
+        s.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+        s.push_back(static_cast<char>(0xC0 | code >> 6));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        s.push_back(static_cast<char>(0xE0 | code >> 12));
+        s.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+        s.push_back(static_cast<char>(0xF0 | code >> 18));
+        s.push_back(static_cast<char>(0x80 | (code >> 12 & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+        s.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+
+// Unpaired surrogates become U+FFFD
+inline std::string utf16_to_utf8(std::u16string const& s) {
+    std::string result;
+    for (std::size_t i = 0; i < s.size(); i++) {
+        std::uint32_t code = s[i];
+        if (0xD800 <= code && code <= 0xDBFF && i + 1 < s.size() && 0xDC00 <= s[i + 1] && s[i + 1] <= 0xDFFF) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (s[++i] - 0xDC00);
+        } else if (0xD800 <= code && code <= 0xDFFF) {
+            code = 0xFFFD;
+        }
+        append_utf8(result, code);
+    }
+    return result;
+}
+
+// Simple case folding of Latin, Greek and Cyrillic letters
+inline std::uint32_t fold_code_point(std::uint32_t c) {
+    if (c < 0x80) {
+        return ('A' <= c && c <= 'Z') ? c + 0x20 : c;
+    }
+    if ((0xC0 <= c && c <= 0xDE && c != 0xD7) || (0x391 <= c && c <= 0x3AB && c != 0x3A2) || (0x410 <= c && c <= 0x42F)) {
+        return c + 0x20;
+    }
+    if (0x400 <= c && c <= 0x40F) {
+        return c + 0x50;
+    }
+    // Capitals whose lower case is outside their block
+    if (c == 0x130) {
+        return 'i';
+    }
+    if (c == 0x178) {
+        return 0xFF;
+    }
+    if ((0x100 <= c && c <= 0x12F) || (0x132 <= c && c <= 0x137) || (0x14A <= c && c <= 0x177) || (0x460 <= c && c <= 0x481) ||
+        (0x48A <= c && c <= 0x4BF) || (0x4D0 <= c && c <= 0x52F)) {
+        return c | 1;
+    }
+    if ((0x139 <= c && c <= 0x148) || (0x179 <= c && c <= 0x17E)) {
+        return (c & 1) ? c + 1 : c;
+    }
+    return c;
+}
+
+// Case folds UTF-8 string, bytes which are not valid UTF-8 are kept as is
+inline std::string to_lower_case(std::string const&s) {
+    std::string t;
+    t.reserve(s.size());
+    for (std::size_t i = 0; i < s.size();) {
+        unsigned char c = s[i];
+        int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        std::uint32_t code = len == 1 ? c : len == 2 ? c & 0x1F : len == 3 ? c & 0x0F : c & 0x07;
+        for (int k = 1; k < len; k++) {
+            if (i + k >= s.size() || (static_cast<unsigned char>(s[i + k]) & 0xC0) != 0x80) {
+                len = 0;
+                break;
+            }
+            code = (code << 6) | (static_cast<unsigned char>(s[i + k]) & 0x3F);
+        }
+        if (len == 0) {
+            t.push_back(s[i++]);
+            continue;
+        }
+        append_utf8(t, fold_code_point(code));
+        i += len;
+    }
+    return t;
+}
+
+inline unsigned int char_to_uint(char c) {
+    return static_cast<unsigned int>(static_cast<unsigned char>(c));
+}
+
+inline std::string remove_whitespace(std::string const& s) {
+    std::string result;
+    for (char c : s) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            result += c;
+        }
+    }
+    return result;
+}
+
+inline std::string remove_char_from_str(std::string const&s, char d) {
+    std::string result;
+    for (char c : s) {
+        if (c != d) {
+            result += c;
+        }
+    }
+    return result;
+}
+
+
+namespace FAT {
+const std::uint32_t MIN_SECTOR_SIZE = 512;
+const std::uint32_t BYTE = 256;
+const std::uint32_t WORD = BYTE * BYTE;
+const std::uint64_t DWORD = static_cast<std::uint64_t>(WORD) * WORD;
+
+inline std::uint64_t extract_with_endian(std::string const& s, int from, int amount, bool is_little_endian = true) {
+    std::uint64_t result = 0;
+    if (is_little_endian) {
+        for (int i = amount - 1; i >= 0; i--) {
+            result = (result << 8) | static_cast<unsigned char>(s[from + i]);
+        }
+    }
+    else {
+        for (int i = 0; i < amount; i++) {
+            result = (result << 8) | static_cast<unsigned char>(s[from + i]);
+        }
+    }
+    return result;
+}
+
+inline void append_with_endian(std::string &s, std::uint64_t value, int amount) {
+    for (int i = 0; i < amount; i++) {
+        s.push_back(static_cast<char>(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+inline std::uint64_t fnv1a(std::string const& s, std::uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (char c : s) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Snapshot is mapped as is, every section starts at offset divisible by 8:
+// header    magic[8] version:4 reserved:4 fingerprint:8 fat_offset:8 fat_size:8
+//           table_offset:8 folders_amount:8 names_offset:8 names_size:8
+// table     folders_amount records of cluster:4 files_amount:4 entries_offset:8, sorted by cluster
+// entries   per folder, files in lookup order: raw directory entry:32 name_offset:4 name_size:4
+// names     long names in UTF-8, offsets are relative to names_offset
+const std::string SNAPSHOT_MAGIC = std::string("FATSNAP", 8);
+const std::uint32_t SNAPSHOT_VERSION = 3;
+const std::string SNAPSHOT_EXT = ".fatsnap";
+const std::uint64_t SNAPSHOT_HEADER_SIZE = 72;
+const std::uint64_t SNAPSHOT_FOLDER_SIZE = 16;
+const std::uint64_t SNAPSHOT_ENTRY_SIZE = 40;
+
+const std::uint32_t CHECK_REPORT_LIMIT = 50;
+const std::uint32_t FAT_COMPARE_SECTORS = 48;
+
+enum FAT_TYPES {
+    NOT_FAT,
+    FAT12,
+    FAT16,
+    FAT32,
+};
+
+struct File_info {
+    std::string name = "";
+    std::string name_no_whitespace = "";
+    std::string long_name = "";
+    std::string name_key = "";
+    std::uint_fast32_t attr = 0;
+    std::uint32_t low_claster_index = 0;
+    std::uint32_t high_claster_index = 0;
+    std::uint32_t claster_index = 0;
+    std::uint64_t size = 0;
+    std::uint32_t date_modify = 0;
+    std::uint32_t year_modify = 0;
+    std::uint32_t month_modify = 0;
+    std::uint32_t day_modify = 0;
+    std::uint32_t time_modify = 0;
+    std::uint32_t hour_modify = 0;
+    std::uint32_t minute_modify = 0;
+    std::uint32_t second_modify = 0;
+    std::uint32_t time_modified = 0;
+    bool is_folder = false;
+    bool is_deleted = false;
+};
+
+inline File_info parse_file_info(std::string const& s, int offset) {
+    File_info file_info;
+    file_info.name = s.substr(offset, 11);
+    file_info.name_no_whitespace = remove_whitespace(file_info.name);
+    file_info.low_claster_index = extract_with_endian(s, offset + 0x1a, 2);
+    file_info.high_claster_index = extract_with_endian(s, offset + 0x14, 2);
+    file_info.size = extract_with_endian(s, offset + 0x1c, 4);
+    file_info.attr = extract_with_endian(s, offset + 0x0b, 1);
+    
+    file_info.date_modify = extract_with_endian(s, offset + 0x18, 2);
+    file_info.day_modify = file_info.date_modify & 0x1F;
+    file_info.month_modify = ((file_info.date_modify & 0x1e0) >> 5) - 1;
+    file_info.year_modify = ((file_info.date_modify & 0xfe00) >> 9) + 1980;
+
+    file_info.time_modify = extract_with_endian(s, offset + 0x16, 2);
+    file_info.second_modify = (file_info.time_modify & 0x1F) * 2;
+    file_info.minute_modify = ((file_info.time_modify & 0x7e0) >> 5);
+    file_info.hour_modify = ((file_info.time_modify & 0xf800) >> 11);
+
+    file_info.claster_index = file_info.low_claster_index + file_info.high_claster_index * WORD;
+    if (file_info.name[0] == static_cast<char>(0xe5)) {
+        file_info.is_deleted = true;
+    }
+    file_info.is_folder = static_cast<bool>(file_info.attr & 0x10);
+    return file_info;
+}
+
+inline std::string encode_file_info(File_info const& file_info) {
+    std::string entry = file_info.name;
+    entry.resize(11, ' ');
+    append_with_endian(entry, file_info.attr, 1);
+    entry.append(8, '\0');
+    append_with_endian(entry, file_info.high_claster_index, 2);
+    append_with_endian(entry, file_info.time_modify, 2);
+    append_with_endian(entry, file_info.date_modify, 2);
+    append_with_endian(entry, file_info.low_claster_index, 2);
+    append_with_endian(entry, file_info.size, 4);
+    return entry;
+}
+
+struct LFN_chain {
+    std::u16string name_part = u"";
+    std::uint32_t order = 0;
+    std::uint32_t check_sum = 0;
+    std::uint32_t attr = 0;
+};
+
+const int LFN_UNIT_OFFSETS[] = {0x01, 0x03, 0x05, 0x07, 0x09, 0x0E, 0x10, 0x12, 0x14, 0x16, 0x18, 0x1C, 0x1E};
+const std::uint32_t LFN_LAST_PART = 0x40;
+const std::uint32_t DELETED_MARK = 0xe5;
+
+inline LFN_chain parse_LFN(std::string const& s, int offset) {
+    LFN_chain lfn;
+    for (int unit_offset : LFN_UNIT_OFFSETS) {
+        char16_t c = extract_with_endian(s, offset + unit_offset, 2);
+        if (c == 0x0000 || c == 0xFFFF) break;
+        lfn.name_part.push_back(c);
+    }
+    lfn.order = extract_with_endian(s, offset, 1);
+    lfn.check_sum = extract_with_endian(s, offset + 0x0d, 1);
+    lfn.attr = extract_with_endian(s, offset + 0x0b, 1);
+    return lfn;
+}
+
+// Checksum of 8.3 name which every LFN part of this entry stores
+inline std::uint32_t lfn_checksum(std::string const& short_name) {
+    std::uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + static_cast<unsigned char>(short_name[i]);
+    }
+    return sum;
+}
+
+struct Folder {
+    std::vector<std::string> path;
+    std::vector<File_info> files;
+    std::uint32_t max_size_len = 0;
+    std::uint32_t files_amount = 0;
+    std::uint32_t dirs_amount = 0;
+
+    std::uint32_t deleted_files_amount = 0;
+    std::uint32_t deleted_dirs_amount = 0;
+};
+
+// Date fields go from year down to day and time fields from hour down to seconds,
+// so numeric order of stamps is chronological
+inline std::uint32_t pack_time_stamp(std::uint32_t date, std::uint32_t time) {
+    return date << 16 | time;
+}
+
+// Modification stamps of whole tree stored by columns and sorted by stamp, row of entry
+// is the same in every column. Path of row is folder_paths[folders[row]] + names[row]
+struct Time_index {
+    std::vector<std::uint32_t> stamps;
+    std::vector<std::uint32_t> folders;
+    std::vector<std::string> names;
+    std::vector<std::uint64_t> sizes;
+    std::vector<std::string> folder_paths;
+
+    std::string get_path(std::size_t row) const {
+        return folder_paths[folders[row]] + names[row];
+    }
+
+    // Rows with from <= stamp <= to are [first, second)
+    std::pair<std::size_t, std::size_t> find_range(std::uint32_t from, std::uint32_t to) const {
+        auto first = std::lower_bound(stamps.begin(), stamps.end(), from);
+        auto last = std::upper_bound(first, stamps.end(), to);
+        return {first - stamps.begin(), last - stamps.begin()};
+    }
+};
+
+class Disk;
+
+// Chain of file kept as extents, read finds extent of offset by binary search and
+// reads every touched extent with one call
+class File_handle {
+    Disk *disk = nullptr;
+    File_info file;
+    std::vector<Extent> extents;
+public:
+    File_handle() = default;
+    File_handle(Disk *disk, File_info const& file, std::vector<Extent> extents)
+        : disk(disk), file(file), extents(std::move(extents)) {}
+
+    File_info const& get_file_info() const {
+        return file;
+    }
+    std::uint64_t size() const {
+        return file.size;
+    }
+
+    // Appends up to length bytes starting at offset to destination, returns amount of appended bytes
+    std::uint64_t read(std::uint64_t offset, std::uint64_t length, std::string &destination) const;
+    std::string read(std::uint64_t offset, std::uint64_t length) const {
+        std::string answer;
+        read(offset, length, answer);
+        return answer;
+    }
+};
+
+class Disk {
+        FILE* fd = nullptr;
+        std::string image_path = "";
+        std::uint64_t fingerprint = 0;
+        // Block devices have no stable size and mtime, snapshots are kept for regular image files only
+        bool is_regular_image = false;
+
+        // Mapped snapshot of this image, folders missing in folder_cache are decoded from it on first use
+        unsigned char const* snapshot = nullptr;
+        std::uint64_t snapshot_size = 0;
+        std::uint64_t snapshot_table = 0;
+        std::uint64_t snapshot_folders = 0;
+        std::uint64_t snapshot_names = 0;
+        std::uint64_t snapshot_names_size = 0;
+
+        std::string fat_data = "";
+        // Folders are shared and immutable once cached, so lookups hand out pointers instead of copies
+        std::map<std::uint32_t, std::shared_ptr<const Folder>> folder_cache;
+        std::shared_ptr<const Time_index> time_index;
+
+        // read and read_sector are seek + fread pairs, clusters are read with pread and need no lock
+        std::mutex io_mutex;
+        std::mutex fat_mutex;
+        std::mutex cache_mutex;
+        
+        FAT_TYPES fat_type = FAT_TYPES::NOT_FAT;
+
+        std::uint32_t SECTOR_SIZE = 0; 
+        std::uint32_t SECTOR_PER_CLASTER = 0; 
+        std::uint32_t RESERVED_SECTOR_AMOUNT = 0;
+        std::uint32_t FAT_TABLE_AMOUNT = 0;
+        std::uint32_t TOTAL_SECTOR_AMOUNT = 0;
+        std::uint32_t FAT_TABLE_SECTOR_AMOUNT = 0;
+        std::uint32_t ROOT_CATALOG_CLASTER_INDEX = 0;
+        std::uint32_t ROOT_ENTRIES = 0;
+        std::uint32_t ROOT_ENT_CNT = 0;
+
+        std::uint32_t BYTES_PER_CLASTER = 0;
+        std::uint32_t FAT_TABLE_SIZE = 0;
+        std::uint32_t FIRST_FAT_SECTOR = 0;
+        std::uint32_t FIRST_DATA_SECTOR = 0;
+        std::uint32_t FIRST_ROOT_DIR_SECTOR = 0;
+        std::uint32_t ROOT_DIR_SECTORS = 0;
+        std::uint32_t DATA_SECTORS = 0;
+        std::uint32_t COUNT_OF_CLUSTERS = 0;
+    
+
+        // Chosen once in read_boot_sector, so chain walks run code specialized for FAT variant
+        Chain_status (*walk_chain)(std::string const&, std::uint32_t, std::uint32_t,
+                                   std::vector<std::uint32_t>&, std::uint32_t&) = nullptr;
+        Chain_status (*walk_extents)(std::string const&, std::uint32_t, std::uint32_t,
+                                     std::vector<Extent>&, std::uint32_t&) = nullptr;
+    private:
+        void read_boot_sector() {
+            auto sector_info = read();
+
+            fat_type = FAT_TYPES::NOT_FAT;
+
+            SECTOR_SIZE = extract_with_endian(sector_info, 0x0b, 2);
+            SECTOR_PER_CLASTER = extract_with_endian(sector_info, 0x0d, 1);
+            RESERVED_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x0e, 2);
+            FAT_TABLE_AMOUNT = extract_with_endian(sector_info, 0x10, 1);
+            ROOT_ENTRIES = extract_with_endian(sector_info, 0x11, 2);
+
+            if (extract_with_endian(sector_info, 0x16, 2) == 0) {
+                FAT_TABLE_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x24, 4);
+            } else {
+                FAT_TABLE_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x16, 2);
+            }
+            if (extract_with_endian(sector_info, 0x13, 2) == 0) {
+                TOTAL_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x20, 4);
+            } else {
+                TOTAL_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x13, 2);
+            }
+            
+            ROOT_CATALOG_CLASTER_INDEX = extract_with_endian(sector_info, 0x2c, 4);
+            ROOT_ENT_CNT = extract_with_endian(sector_info, 0x11, 2);
+            BYTES_PER_CLASTER = SECTOR_SIZE * SECTOR_PER_CLASTER;
+            FAT_TABLE_SIZE = FAT_TABLE_SECTOR_AMOUNT * SECTOR_SIZE;
+            FIRST_FAT_SECTOR = RESERVED_SECTOR_AMOUNT;
+            ROOT_DIR_SECTORS = ((ROOT_ENT_CNT * 32) + (SECTOR_SIZE - 1)) / SECTOR_SIZE;
+            FIRST_ROOT_DIR_SECTOR = FIRST_FAT_SECTOR + FAT_TABLE_AMOUNT * FAT_TABLE_SECTOR_AMOUNT;
+            FIRST_DATA_SECTOR = FIRST_ROOT_DIR_SECTOR + ROOT_DIR_SECTORS;
+            DATA_SECTORS = TOTAL_SECTOR_AMOUNT - FIRST_DATA_SECTOR;
+            COUNT_OF_CLUSTERS = DATA_SECTORS / SECTOR_PER_CLASTER;
+
+            if(COUNT_OF_CLUSTERS < 4085) {
+                std::cout << "FAT12" << std::endl;
+                fat_type = FAT_TYPES::FAT12;
+                walk_chain = walk_claster_chain<FAT12_traits>;
+                walk_extents = walk_claster_extents<FAT12_traits>;
+            } else if(COUNT_OF_CLUSTERS < 65525) {
+                std::cout << "FAT16" << std::endl;
+                fat_type = FAT_TYPES::FAT16;
+                walk_chain = walk_claster_chain<FAT16_traits>;
+                walk_extents = walk_claster_extents<FAT16_traits>;
+            } else {
+                std::cout << "FAT32" << std::endl;
+                fat_type = FAT_TYPES::FAT32;
+                walk_chain = walk_claster_chain<FAT32_traits>;
+                walk_extents = walk_claster_extents<FAT32_traits>;
+            }
+
+            std::cout << "Sector size " << SECTOR_SIZE << std::endl;
+            std::cout << "Sector per claster " << SECTOR_PER_CLASTER << std::endl;
+            std::cout << "RESERVED_SECTOR_AMOUNT " << RESERVED_SECTOR_AMOUNT << std::endl;
+            std::cout << "FAT_TABLE_AMOUNT " << FAT_TABLE_AMOUNT << std::endl;
+            std::cout << "TOTAL_SECTOR_AMOUNT " << TOTAL_SECTOR_AMOUNT << std::endl;
+            std::cout << "FAT_TABLE_SECTOR_AMOUNT " << FAT_TABLE_SECTOR_AMOUNT << std::endl;
+            std::cout << "ROOT_CATALOG_CLASTER_INDEX " << ROOT_CATALOG_CLASTER_INDEX << std::endl;
+            std::cout << "BYTES_PER_CLASTER " << BYTES_PER_CLASTER << std::endl;
+            std::cout << "FAT_TABLE_SIZE " << FAT_TABLE_SIZE << std::endl;
+            std::cout << "FIRST_FAT_SECTOR " << FIRST_FAT_SECTOR << std::endl;
+            std::cout << "FIRST_DATA_SECTOR " << FIRST_DATA_SECTOR << std::endl;
+            std::cout << "COUNT_OF_CLUSTERS " << COUNT_OF_CLUSTERS << std::endl;
+            std::cout << "FIRST_ROOT_DIR_SECTOR " << FIRST_ROOT_DIR_SECTOR << std::endl;
+        }
+
+        void load_fat() {
+            std::lock_guard<std::mutex> lock(fat_mutex);
+            if (fat_data != "") return;
+            std::string fat;
+            for (std::uint32_t i = 0; i < FAT_TABLE_SECTOR_AMOUNT; i++) {
+                fat += read_sector(FIRST_FAT_SECTOR + i);
+            }
+            fat_data = fat;
+        }
+
+        std::shared_ptr<const Folder> find_cached_folder(std::uint32_t cluster) {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto cached = folder_cache.find(cluster);
+            if (cached == folder_cache.end()) {
+                return nullptr;
+            }
+            return cached->second;
+        }
+
+        // Folder parsed by another thread in the meantime wins, so every caller sees the same object
+        std::shared_ptr<const Folder> cache_folder(std::uint32_t cluster, Folder folder) {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            return folder_cache.emplace(cluster, std::make_shared<const Folder>(std::move(folder))).first->second;
+        }
+
+        std::uint32_t folder_key(std::uint32_t first_cluster) {
+            return first_cluster == 0 && fat_type == FAT_TYPES::FAT32 ? ROOT_CATALOG_CLASTER_INDEX : first_cluster;
+        }
+
+        // Snapshot first, disk otherwise, cache is not touched
+        Folder load_folder(std::uint32_t first_cluster) {
+            Folder folder;
+            if (decode_snapshot_folder(folder_key(first_cluster), folder)) {
+                return folder;
+            }
+            return read_folder(first_cluster);
+        }
+
+        // Reads folder from disk without cache, 0 is root
+        Folder read_folder(std::uint32_t first_cluster) {
+            Folder folder;
+            LFN_chain LFN;
+            if (first_cluster == 0 && fat_type != FAT_TYPES::FAT32) {
+                for (int pos = FIRST_ROOT_DIR_SECTOR; pos < ROOT_DIR_SECTORS + FIRST_ROOT_DIR_SECTOR; pos++) {
+                    parse_entries(read_sector(pos), folder, LFN);
+                }
+            } else {
+                auto chain = get_claster_chain(first_cluster == 0 ? ROOT_CATALOG_CLASTER_INDEX : first_cluster);
+                for (std::uint32_t cluster_index = 0; cluster_index < chain.size(); cluster_index++) {
+                    parse_entries(read_cluster(chain[cluster_index]), folder, LFN);
+                }
+            }
+            config_folder(folder);
+            return folder;
+        }
+
+        std::uint64_t compute_fingerprint() {
+            std::uint64_t hash = fnv1a(read());
+            struct stat info;
+            if (fstat(fileno(fd), &info) != 0) {
+                throw std::string("Failed to stat disk : ") + image_path;
+            }
+            is_regular_image = S_ISREG(info.st_mode);
+            if (!is_regular_image) {
+                return hash;
+            }
+            std::string stat;
+            append_with_endian(stat, info.st_size, 8);
+            append_with_endian(stat, info.st_mtim.tv_sec, 8);
+            append_with_endian(stat, info.st_mtim.tv_nsec, 8);
+            return fnv1a(stat, hash);
+        }
+
+        void load_all_folders() {
+            std::vector<std::uint32_t> queue = {0};
+            while (!queue.empty()) {
+                std::uint32_t cluster = queue.back();
+                queue.pop_back();
+                std::shared_ptr<const Folder> folder;
+                try {
+                    folder = get_folder(cluster);
+                } catch (std::string err) {
+                    std::cerr << "Skipping folder at claster " << cluster << " : " << err << std::endl;
+                    continue;
+                }
+                for (auto const& file : folder->files) {
+                    if (!file.is_folder || file.is_deleted || file.claster_index == 0) continue;
+                    if (file.name_no_whitespace == "." || file.name_no_whitespace == "..") continue;
+                    if (!find_cached_folder(file.claster_index)) {
+                        queue.push_back(file.claster_index);
+                    }
+                }
+            }
+        }
+
+        static void check_chain_status(Chain_status status, std::uint32_t end) {
+            switch (status) {
+                case Chain_status::BAD_CLUSTER:
+                    throw std::string("Chain of clusters end in bad cluster");
+                case Chain_status::NOT_EOC:
+                    std::cerr << "Bad Cluster index : 0x" << std::hex << end << std::dec << std::endl;
+                    throw std::string("Chain of clusters end in not EOC cluster");
+                case Chain_status::LOOP:
+                    throw std::string("Chain of clusters is looped");
+                case Chain_status::OK:
+                case Chain_status::STOPPED:
+                    break;
+            }
+        }
+        std::vector<std::uint32_t> get_claster_chain(std::uint32_t start) {
+            load_fat();
+            std::vector<std::uint32_t> chain;
+            std::uint32_t end = 0;
+            check_chain_status(walk_chain(fat_data, COUNT_OF_CLUSTERS, start, chain, end), end);
+            return chain;
+        }
+        std::vector<Extent> get_claster_extents(std::uint32_t start) {
+            load_fat();
+            std::vector<Extent> extents;
+            std::uint32_t end = 0;
+            check_chain_status(walk_extents(fat_data, COUNT_OF_CLUSTERS, start, extents, end), end);
+            return extents;
+        }
+
+        // Counts entries of every FAT copy which differ from the first one, reading copies by chunks
+        template <class Traits>
+        std::vector<std::uint64_t> compare_fat_copies() {
+            std::vector<std::uint64_t> mismatches;
+            for (std::uint32_t copy = 1; copy < FAT_TABLE_AMOUNT; copy++) {
+                std::uint64_t differing = 0;
+                for (std::uint32_t first = 0; first < FAT_TABLE_SECTOR_AMOUNT; first += FAT_COMPARE_SECTORS) {
+                    std::uint32_t amount = std::min(FAT_COMPARE_SECTORS, FAT_TABLE_SECTOR_AMOUNT - first);
+                    std::string chunk;
+                    for (std::uint32_t i = 0; i < amount; i++) {
+                        chunk += read_sector(FIRST_FAT_SECTOR + copy * FAT_TABLE_SECTOR_AMOUNT + first + i);
+                    }
+                    differing += count_differing_entries<Traits>(fat_data.substr(first * SECTOR_SIZE, chunk.size()), chunk);
+                }
+                mismatches.push_back(differing);
+            }
+            return mismatches;
+        }
+
+        // One pass over tree: workers take folders from shared queue, parse them and keep rows locally,
+        // rows are merged and sorted by stamp at the end
+        std::shared_ptr<const Time_index> build_time_index() {
+            struct Row {
+                std::uint32_t stamp;
+                std::uint32_t folder;
+                std::string name;
+                std::uint64_t size;
+            };
+
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> queue = {{0, 0}};
+            std::vector<std::string> folder_paths = {"/"};
+            std::vector<bool> queued(static_cast<std::uint64_t>(COUNT_OF_CLUSTERS) + 2);
+            if (fat_type == FAT_TYPES::FAT32 && ROOT_CATALOG_CLASTER_INDEX < queued.size())
+                queued[ROOT_CATALOG_CLASTER_INDEX] = true;
+            std::size_t busy = 0;
+
+            auto work = [&](std::vector<Row> &rows) {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    changed.wait(lock, [&] { return !queue.empty() || busy == 0; });
+                    if (queue.empty()) return;
+                    auto [claster, folder_id] = queue.back();
+                    queue.pop_back();
+                    std::string path = folder_paths[folder_id];
+                    busy++;
+                    lock.unlock();
+
+                    std::vector<std::pair<std::uint32_t, std::string>> subfolders;
+                    try {
+                        // Folder is dropped once its rows and subfolders are taken, index is the only copy of names
+                        auto folder = peek_folder(claster);
+                        for (auto const& file : folder->files) {
+                            if (file.is_deleted || file.attr == 0x0f || file.attr & 0x08) continue;
+                            if (file.name_no_whitespace == "." || file.name_no_whitespace == "..") continue;
+                            std::string name = get_file_show_name(file) + (file.is_folder ? "/" : "");
+                            if (file.is_folder && file.claster_index != 0)
+                                subfolders.push_back({file.claster_index, path + name});
+                            rows.push_back({pack_time_stamp(file.date_modify, file.time_modify), folder_id, std::move(name), file.size});
+                        }
+                    } catch (std::string err) {
+                        std::cerr << "Skipping folder " << path << " : " << err << std::endl;
+                    }
+
+                    lock.lock();
+                    for (auto &[sub_claster, sub_path] : subfolders) {
+                        // Looped or cross-linked folders are indexed once
+                        if (sub_claster >= queued.size() || queued[sub_claster]) continue;
+                        queued[sub_claster] = true;
+                        folder_paths.push_back(std::move(sub_path));
+                        queue.push_back({sub_claster, static_cast<std::uint32_t>(folder_paths.size() - 1)});
+                    }
+                    busy--;
+                    changed.notify_all();
+                }
+            };
+
+            std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+            std::vector<std::vector<Row>> rows(workers);
+            std::vector<std::thread> threads;
+            for (std::size_t i = 1; i < workers; i++) {
+                threads.emplace_back(work, std::ref(rows[i]));
+            }
+            work(rows[0]);
+            for (auto &thread : threads) {
+                thread.join();
+            }
+
+            std::vector<Row> all;
+            for (auto &part : rows) {
+                std::move(part.begin(), part.end(), std::back_inserter(all));
+                part = {};
+            }
+            std::sort(all.begin(), all.end(), [](Row const& a, Row const& b) {
+                return std::tie(a.stamp, a.folder, a.name) < std::tie(b.stamp, b.folder, b.name);
+            });
+
+            auto index = std::make_shared<Time_index>();
+            index->stamps.reserve(all.size());
+            index->folders.reserve(all.size());
+            index->names.reserve(all.size());
+            index->sizes.reserve(all.size());
+            for (auto &row : all) {
+                index->stamps.push_back(row.stamp);
+                index->folders.push_back(row.folder);
+                index->names.push_back(std::move(row.name));
+                index->sizes.push_back(row.size);
+            }
+            index->folder_paths = std::move(folder_paths);
+            return index;
+        }
+
+        template <class Traits>
+        void check_impl() {
+            load_fat();
+            auto data = reinterpret_cast<unsigned char const*>(fat_data.data());
+            std::uint32_t const last = last_claster_index<Traits>(fat_data, COUNT_OF_CLUSTERS);
+
+            // FAT side: which clasters are targets of some link and FAT copies, runs while tree is swept
+            std::vector<bool> referenced(last + 1);
+            std::uint64_t shared_targets = 0, wild_links = 0;
+            auto fat_sweep = std::async(std::launch::async, [&] {
+                for (std::uint32_t claster = Traits::CLASTER_MIN; claster <= last; claster++) {
+                    std::uint32_t next = Traits::load(data, claster);
+                    if (Traits::CLASTER_MIN <= next && next <= last) {
+                        if (referenced[next]) shared_targets++;
+                        referenced[next] = true;
+                    } else if (next != Traits::FREE && next != Traits::BAD && next < Traits::EOC_MIN) {
+                        wild_links++;
+                    }
+                }
+                return compare_fat_copies<Traits>();
+            });
+
+            std::uint64_t problems = 0, files = 0, folders = 0;
+            std::uint64_t cross_linked = 0, looped = 0, broken = 0, size_mismatch = 0;
+            auto report = [&](std::uint64_t &counter, std::string const& path, std::string const& message) {
+                counter++;
+                if (problems++ < CHECK_REPORT_LIMIT) {
+                    std::cout << path << " : " << message << std::endl;
+                }
+            };
+
+            // Tree side: every claster may be owned by one chain only, walking marks current chain to tell loops from cross-links
+            std::vector<bool> owned(last + 1), walking(last + 1);
+            auto claim = [&](std::uint32_t start, std::string const& path, std::uint64_t &length) {
+                bool loop = false;
+                std::uint32_t end = 0;
+                length = 0;
+                auto status = visit_claster_chain<Traits>(fat_data, COUNT_OF_CLUSTERS, start, [&](std::uint32_t claster) {
+                    if (walking[claster]) {
+                        loop = true;
+                        return false;
+                    }
+                    if (owned[claster]) {
+                        return false;
+                    }
+                    walking[claster] = owned[claster] = true;
+                    length++;
+                    return true;
+                }, end);
+                std::uint32_t current = start;
+                for (std::uint64_t i = 0; i < length; i++) {
+                    walking[current] = false;
+                    current = Traits::load(data, current);
+                }
+
+                std::stringstream hex;
+                hex << "0x" << std::hex << end;
+                if (status == Chain_status::LOOP || loop) {
+                    report(looped, path, "chain is looped at claster " + hex.str());
+                } else if (status == Chain_status::STOPPED) {
+                    report(cross_linked, path, "claster " + hex.str() + " is cross-linked with another chain");
+                } else if (status == Chain_status::BAD_CLUSTER) {
+                    report(broken, path, "chain ends in bad claster");
+                } else if (status == Chain_status::NOT_EOC) {
+                    report(broken, path, "chain ends in " + hex.str() + " instead of EOC");
+                }
+                return status == Chain_status::OK && !loop;
+            };
+
+            std::vector<std::pair<std::uint32_t, std::string>> stack;
+            std::uint64_t length = 0;
+            if (fat_type == FAT_TYPES::FAT32) {
+                if (claim(ROOT_CATALOG_CLASTER_INDEX, "/", length))
+                    stack.push_back({ROOT_CATALOG_CLASTER_INDEX, "/"});
+            } else {
+                stack.push_back({0, "/"});
+            }
+            while (!stack.empty()) {
+                auto [claster, path] = stack.back();
+                stack.pop_back();
+                // Folder is read past the cache and dropped once its children are pushed,
+                // so memory of the sweep is the bitsets and the stack only
+                Folder folder;
+                try {
+                    folder = read_folder(claster);
+                } catch (std::string err) {
+                    report(broken, path, err);
+                    continue;
+                }
+                folders++;
+                for (auto const& file : folder.files) {
+                    if (file.is_deleted || file.attr == 0x0f || file.attr & 0x08) continue;
+                    if (file.name_no_whitespace == "." || file.name_no_whitespace == "..") continue;
+                    std::string file_path = path + get_file_show_name(file) + (file.is_folder ? "/" : "");
+                    if (file.is_folder) {
+                        if (claim(file.claster_index, file_path, length))
+                            stack.push_back({file.claster_index, file_path});
+                        continue;
+                    }
+                    files++;
+                    length = 0;
+                    if (file.claster_index != 0 && !claim(file.claster_index, file_path, length))
+                        continue;
+                    std::uint64_t expected = (file.size + BYTES_PER_CLASTER - 1) / BYTES_PER_CLASTER;
+                    if (length != expected) {
+                        report(size_mismatch, file_path, "chain has " + std::to_string(length) + " claster(s), size " +
+                            std::to_string(file.size) + " needs " + std::to_string(expected));
+                    }
+                }
+            }
+
+            auto copy_mismatches = fat_sweep.get();
+            std::uint64_t lost = 0, lost_chains = 0;
+            for (std::uint32_t claster = Traits::CLASTER_MIN; claster <= last; claster++) {
+                std::uint32_t next = Traits::load(data, claster);
+                if (next == Traits::FREE || next == Traits::BAD || owned[claster]) continue;
+                lost++;
+                if (!referenced[claster]) lost_chains++;
+            }
+
+            if (problems > CHECK_REPORT_LIMIT) {
+                std::cout << "... and " << problems - CHECK_REPORT_LIMIT << " more problem(s)" << std::endl;
+            }
+            std::cout << "Checked " << files << " file(s) in " << folders << " folder(s)" << std::endl;
+            std::cout << "Cross-linked chains : " << cross_linked << " (" << shared_targets << " claster(s) are targets of several links)" << std::endl;
+            std::cout << "Looped chains : " << looped << std::endl;
+            std::cout << "Broken chains : " << broken << " (" << wild_links << " link(s) out of data area)" << std::endl;
+            std::cout << "Size mismatches : " << size_mismatch << std::endl;
+            std::cout << "Lost clasters : " << lost << " in " << lost_chains << " chain(s)" << std::endl;
+            for (std::uint32_t copy = 0; copy < copy_mismatches.size(); copy++) {
+                std::cout << "FAT copy " << copy + 2 << " mismatching entries : " << copy_mismatches[copy] << std::endl;
+            }
+        }
+    public:
+        bool is_mounted() {
+            return fd != nullptr;
+        }
+
+        void mount(std::string path) {
+            fd = fopen(path.c_str(), "rb");
+            if (!fd) {
+                throw std::string("Failed to mount disk : ") + path;
+            }
+            image_path = path;
+            read_boot_sector();
+            fingerprint = compute_fingerprint();
+            if (is_regular_image && std::filesystem::exists(path + SNAPSHOT_EXT) && load_snapshot(path + SNAPSHOT_EXT)) {
+                std::cout << "Metadata snapshot loaded : " << path + SNAPSHOT_EXT << std::endl;
+            }
+        }
+
+        void unmount() {
+            if (!fd) return;
+
+            {
+                std::lock_guard<std::mutex> lock(fat_mutex);
+                fat_data = "";
+            }
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                folder_cache.clear();
+                time_index.reset();
+            }
+            unmap_snapshot();
+            if (fclose(fd) == EOF) {
+                throw std::string("Failed to unmount disk");
+            }
+            fd = nullptr;
+        }
+
+        // One linear FAT sweep in parallel with one sweep of directory tree, damage is reported instead of thrown
+        void check() {
+            switch (fat_type) {
+                case FAT_TYPES::FAT12:
+                    return check_impl<FAT12_traits>();
+                case FAT_TYPES::FAT16:
+                    return check_impl<FAT16_traits>();
+                case FAT_TYPES::FAT32:
+                    return check_impl<FAT32_traits>();
+                case FAT_TYPES::NOT_FAT:
+                    throw std::string("Disk is not FAT");
+            }
+        }
+
+        std::string get_image_path() {
+            return image_path;
+        }
+
+        // Built on first query and kept until unmount
+        std::shared_ptr<const Time_index> get_time_index() {
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                if (time_index) return time_index;
+            }
+            auto index = build_time_index();
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            time_index = index;
+            return time_index;
+        }
+        void save_snapshot(std::string const& path) {
+            if (!is_regular_image) {
+                throw std::string("Snapshots are supported for image files only");
+            }
+            load_fat();
+            load_all_folders();
+
+            auto pad = [](std::string &data) {
+                data.resize((data.size() + 7) / 8 * 8, '\0');
+            };
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            std::string data = SNAPSHOT_MAGIC;
+            append_with_endian(data, SNAPSHOT_VERSION, 4);
+            append_with_endian(data, 0, 4);
+            append_with_endian(data, fingerprint, 8);
+            append_with_endian(data, SNAPSHOT_HEADER_SIZE, 8);
+            append_with_endian(data, fat_data.size(), 8);
+            data.resize(SNAPSHOT_HEADER_SIZE, '\0');
+            data += fat_data;
+            pad(data);
+
+            std::uint64_t table = data.size();
+            std::uint64_t entries = table + folder_cache.size() * SNAPSHOT_FOLDER_SIZE;
+            std::string names;
+            for (auto const& [cluster, folder] : folder_cache) {
+                append_with_endian(data, cluster, 4);
+                append_with_endian(data, folder->files.size(), 4);
+                append_with_endian(data, entries, 8);
+                entries += folder->files.size() * SNAPSHOT_ENTRY_SIZE;
+            }
+            for (auto const& [cluster, folder] : folder_cache) {
+                for (auto const& file : folder->files) {
+                    data += encode_file_info(file);
+                    append_with_endian(data, names.size(), 4);
+                    append_with_endian(data, file.long_name.size(), 4);
+                    names += file.long_name;
+                }
+            }
+            std::uint64_t names_offset = data.size();
+            data += names;
+            std::string tail;
+            append_with_endian(tail, table, 8);
+            append_with_endian(tail, folder_cache.size(), 8);
+            append_with_endian(tail, names_offset, 8);
+            append_with_endian(tail, names.size(), 8);
+            data.replace(40, tail.size(), tail);
+
+            // Snapshot may be mapped right now, so new one replaces it by rename instead of being written in place
+            std::string temporary = path + ".tmp";
+            auto out = fopen(temporary.c_str(), "wb");
+            if (!out) {
+                throw std::string("Failed to open file : " + temporary);
+            }
+            bool written = fwrite(data.data(), 1, data.size(), out) == data.size();
+            if (fclose(out) == EOF || !written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+                std::remove(temporary.c_str());
+                throw std::string("Failed to write file : " + path);
+            }
+            std::cout << "Snapshot of " << folder_cache.size() << " folder(s) saved : " << path << std::endl;
+        }
+
+        // Maps snapshot and takes FAT from it, folders stay in the mapping until they are used
+        bool load_snapshot(std::string const& path) {
+            int snapshot_fd = open(path.c_str(), O_RDONLY);
+            if (snapshot_fd < 0) {
+                return false;
+            }
+            struct stat info;
+            void* map = MAP_FAILED;
+            if (fstat(snapshot_fd, &info) == 0 && static_cast<std::uint64_t>(info.st_size) >= SNAPSHOT_HEADER_SIZE) {
+                map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, snapshot_fd, 0);
+            }
+            close(snapshot_fd);
+            if (map == MAP_FAILED) {
+                std::cerr << "Ignoring unknown snapshot format : " << path << std::endl;
+                return false;
+            }
+            unmap_snapshot();
+            snapshot = static_cast<unsigned char const*>(map);
+            snapshot_size = info.st_size;
+
+            auto fits = [&](std::uint64_t offset, std::uint64_t amount) {
+                return offset <= snapshot_size && amount <= snapshot_size - offset;
+            };
+            std::uint64_t fat_offset = load_le64(snapshot + 24), fat_size = load_le64(snapshot + 32);
+            snapshot_table = load_le64(snapshot + 40);
+            snapshot_folders = load_le64(snapshot + 48);
+            snapshot_names = load_le64(snapshot + 56);
+            snapshot_names_size = load_le64(snapshot + 64);
+            if (std::memcmp(snapshot, SNAPSHOT_MAGIC.data(), SNAPSHOT_MAGIC.size()) != 0 ||
+                load_le32(snapshot + 8) != SNAPSHOT_VERSION || !fits(fat_offset, fat_size) ||
+                snapshot_folders > snapshot_size / SNAPSHOT_FOLDER_SIZE ||
+                !fits(snapshot_table, snapshot_folders * SNAPSHOT_FOLDER_SIZE) || !fits(snapshot_names, snapshot_names_size)) {
+                std::cerr << "Ignoring unknown snapshot format : " << path << std::endl;
+                unmap_snapshot();
+                return false;
+            }
+            if (load_le64(snapshot + 16) != fingerprint) {
+                std::cerr << "Ignoring stale snapshot : " << path << std::endl;
+                unmap_snapshot();
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(fat_mutex);
+            fat_data.assign(reinterpret_cast<char const*>(snapshot + fat_offset), fat_size);
+            return true;
+        }
+
+        void unmap_snapshot() {
+            if (snapshot) {
+                munmap(const_cast<unsigned char*>(snapshot), snapshot_size);
+            }
+            snapshot = nullptr;
+            snapshot_size = snapshot_folders = 0;
+        }
+
+        // Binary search in folder table of mapped snapshot, damaged record falls back to reading disk
+        bool decode_snapshot_folder(std::uint32_t cluster, Folder &folder) {
+            std::uint64_t low = 0, high = snapshot_folders;
+            while (low < high) {
+                std::uint64_t middle = (low + high) / 2;
+                if (load_le32(snapshot + snapshot_table + middle * SNAPSHOT_FOLDER_SIZE) < cluster) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            unsigned char const* record = snapshot + snapshot_table + low * SNAPSHOT_FOLDER_SIZE;
+            if (low == snapshot_folders || load_le32(record) != cluster) {
+                return false;
+            }
+            std::uint64_t files_amount = load_le32(record + 4), entries = load_le64(record + 8);
+            if (entries > snapshot_size || files_amount > (snapshot_size - entries) / SNAPSHOT_ENTRY_SIZE) {
+                std::cerr << "Snapshot record of claster " << cluster << " is damaged" << std::endl;
+                return false;
+            }
+            std::string data(reinterpret_cast<char const*>(snapshot + entries), files_amount * SNAPSHOT_ENTRY_SIZE);
+            folder.files.reserve(files_amount);
+            for (std::uint64_t i = 0; i < files_amount; i++) {
+                File_info file = parse_file_info(data, i * SNAPSHOT_ENTRY_SIZE);
+                std::uint64_t name_offset = extract_with_endian(data, i * SNAPSHOT_ENTRY_SIZE + 32, 4);
+                std::uint64_t name_size = extract_with_endian(data, i * SNAPSHOT_ENTRY_SIZE + 36, 4);
+                if (name_offset > snapshot_names_size || name_size > snapshot_names_size - name_offset) {
+                    std::cerr << "Snapshot record of claster " << cluster << " is damaged" << std::endl;
+                    folder = Folder();
+                    return false;
+                }
+                set_long_name(file, std::string(reinterpret_cast<char const*>(snapshot + snapshot_names + name_offset), name_size));
+                folder.files.push_back(std::move(file));
+            }
+            config_folder(folder);
+            return true;
+        }
+
+        FILE* get() {
+            return fd;
+        }
+
+        void seek(int position) {
+            if (fseek(fd, position, SEEK_SET)) {
+                throw std::string("Error in fseek") + std::to_string(position);
+            }
+        }
+
+        std::string continue_reading() {
+            char data[MIN_SECTOR_SIZE];
+
+            fread(data, MIN_SECTOR_SIZE, 1, fd);
+            if (ferror(fd)) {
+                throw std::string("Error in file reading");
+            }
+
+            return std::string(data, MIN_SECTOR_SIZE);
+        }
+
+        std::string read(int position = 0) {
+            std::lock_guard<std::mutex> lock(io_mutex);
+            seek(position);
+            return continue_reading();
+        }
+
+        std::string read_sector(int sector_pos) {
+            std::lock_guard<std::mutex> lock(io_mutex);
+            seek(sector_pos * SECTOR_SIZE);
+            std::string answer;
+            for (int i = 0; i < SECTOR_SIZE / MIN_SECTOR_SIZE; i++) {
+                answer += continue_reading();
+            }
+            return answer;
+        }
+
+        // pread keeps shared file position untouched, so several threads may read clusters at once
+        // Appends amount bytes starting skip bytes after beginning of cluster_pos, the clusters
+        // covered must be consecutive. Bytes beyond end of image are zero
+        void read_cluster_range(std::uint32_t cluster_pos, std::uint64_t skip, std::uint64_t amount, std::string &destination) {
+            std::uint64_t position = ((static_cast<std::uint64_t>(cluster_pos) - 2) * SECTOR_PER_CLASTER + FIRST_DATA_SECTOR) * SECTOR_SIZE + skip;
+            std::size_t from = destination.size();
+            destination.resize(from + amount, '\0');
+            std::size_t done = 0;
+            while (done < amount) {
+                ssize_t result = pread(fileno(fd), destination.data() + from + done, amount - done, position + done);
+                if (result < 0 && errno == EINTR) continue;
+                if (result < 0) {
+                    throw std::string("Error in file reading");
+                }
+                if (result == 0) break;
+                done += result;
+            }
+        }
+        std::string read_cluster(std::uint32_t cluster_pos) {
+            std::string answer;
+            read_cluster_range(cluster_pos, 0, BYTES_PER_CLASTER, answer);
+            return answer;
+        }
+
+        // LFN parts precede their 8.3 entry in reverse order, LFN keeps collected parts between calls.
+        // Name is used only when its checksum matches 8.3 name, deleted entries lost the first byte needed for it
+        void parse_entries(std::string const& data, Folder &folder, LFN_chain &LFN) {
+            for (int i = 0; i < data.size(); i+=32) {
+                if (extract_with_endian(data, i, 1) == 0x0) {
+                    continue; // все же тут break или continue???
+                }
+                File_info file = parse_file_info(data, i);
+                if (file.attr == 0x0f) {
+                    LFN_chain lfn = parse_LFN(data, i);
+                    bool starts_name = lfn.order != DELETED_MARK && (lfn.order & LFN_LAST_PART);
+                    if (starts_name || lfn.check_sum != LFN.check_sum) {
+                        LFN.name_part = u"";
+                    }
+                    LFN.name_part = lfn.name_part + LFN.name_part;
+                    LFN.check_sum = lfn.check_sum;
+                    continue;
+                }
+                std::string long_name = "";
+                if (LFN.name_part != u"" && (file.is_deleted || lfn_checksum(file.name) == LFN.check_sum)) {
+                    long_name = utf16_to_utf8(LFN.name_part);
+                }
+                set_long_name(file, long_name);
+                LFN = LFN_chain();
+                folder.files.push_back(file);
+            }
+        }
+
+        // Cached folder without copy, 0 is root for every FAT type
+        std::shared_ptr<const Folder> get_folder(std::uint32_t first_cluster) {
+            std::uint32_t key = folder_key(first_cluster);
+            if (auto cached = find_cached_folder(key)) {
+                return cached;
+            }
+            return cache_folder(key, load_folder(first_cluster));
+        }
+
+        // Same lookup as get_folder, but folder missing in cache is not added to it. For whole tree
+        // passes, which would otherwise keep every folder until unmount
+        std::shared_ptr<const Folder> peek_folder(std::uint32_t first_cluster) {
+            if (auto cached = find_cached_folder(folder_key(first_cluster))) {
+                return cached;
+            }
+            return std::make_shared<const Folder>(load_folder(first_cluster));
+        }
+
+        Folder parse_folder(std::uint32_t first_cluster, std::vector<std::string> previous_path, std::string next="") {
+            Folder folder = *get_folder(first_cluster);
+            if (next != "")
+                previous_path.push_back(next);
+            folder.path = previous_path;
+            return folder;
+        }
+
+        Folder parse_root_folder() {
+            return *get_folder(0);
+        }
+
+        File_handle open_file(File_info const& file) {
+            if (file.size == 0) {
+                return File_handle(this, file, {});
+            }
+            return File_handle(this, file, get_claster_extents(file.claster_index));
+        }
+
+        std::uint32_t get_bytes_per_claster() {
+            return BYTES_PER_CLASTER;
+        }
+
+        void get_file(std::uint32_t first_claster, std::string &destination) {
+            auto chain = get_claster_chain(first_claster);
+            destination = "";
+            for (int i = 0; i < chain.size(); i++) {
+                destination += read_cluster(chain[i]);
+            }
+        }
+
+        static std::string get_file_show_name(File_info const& file) {
+            if (file.long_name != "") {
+                return file.long_name;
+            }
+            std::string name = file.name.substr(0, 8), ext = file.name.substr(8);
+            if (file.is_deleted) {
+                name[0] = '?';
+            }
+            name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+            ext.erase(std::remove(ext.begin(), ext.end(), ' '), ext.end());
+            if (ext != "") {
+                ext = "." + ext;
+            }
+            return name + ext;
+        }
+
+        // Lookup key is computed once per entry, so sorting and searching only compare bytes
+        static void set_long_name(File_info &file, std::string const& long_name) {
+            file.long_name = long_name;
+            file.name_key = to_lower_case(get_file_show_name(file));
+        }
+
+        static bool cmp_files_name(File_info const&a, File_info const&b) {
+            return a.name_key < b.name_key;
+        }
+
+        void config_folder(Folder & folder) {
+            std::sort(folder.files.begin(), folder.files.end(), cmp_files_name);
+            std::uint64_t max_size = 0;
+            for (auto file : folder.files) {
+                max_size = std::max(max_size, file.size);
+                if (file.is_folder) {
+                    if (!file.is_deleted)
+                        folder.dirs_amount ++;
+                    else
+                        folder.deleted_dirs_amount++;
+                } else {
+                    if (!file.is_deleted)
+                        folder.files_amount ++;
+                    else
+                        folder.deleted_files_amount++;
+                }
+            }
+            folder.max_size_len = 1;
+            std::uint64_t mul = 1;
+            while (mul < max_size) {
+                mul *= 10;
+                folder.max_size_len ++;
+            }
+        }
+
+        ~Disk() {
+            try {
+                unmount();
+            } catch (std::string err) {
+                std::cerr << err << std::endl;
+            } catch (...) {
+                std::cerr << "Some unknown error in Disk destructor occured" << std::endl;
+            }
+        }
+    };
+
+    inline std::uint64_t File_handle::read(std::uint64_t offset, std::uint64_t length, std::string &destination) const {
+        if (offset >= file.size) {
+            return 0;
+        }
+        length = std::min(length, file.size - offset);
+        std::uint64_t claster_size = disk->get_bytes_per_claster();
+        std::uint64_t done = 0;
+        while (done < length) {
+            std::uint64_t position = offset + done;
+            std::uint64_t index = position / claster_size;
+            auto extent = std::upper_bound(extents.begin(), extents.end(), index, [](std::uint64_t i, Extent const& e) {
+                return i < e.file_claster;
+            });
+            if (extent == extents.begin() || index >= (extent - 1)->file_claster + (extent - 1)->length) {
+                throw std::string("Chain of clusters is shorter than file");
+            }
+            extent--;
+            std::uint64_t skip = (index - extent->file_claster) * claster_size + position % claster_size;
+            std::uint64_t amount = std::min(length - done, extent->length * claster_size - skip);
+            disk->read_cluster_range(extent->first_claster, skip, amount, destination);
+            done += amount;
+        }
+        return done;
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace FAT {
+
+inline std::uint32_t load_le16(unsigned char const* p) {
+    return static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8;
+}
+
+inline std::uint32_t load_le32(unsigned char const* p) {
+    return static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8 |
+           static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+}
+
+inline std::uint64_t load_le64(unsigned char const* p) {
+    return static_cast<std::uint64_t>(load_le32(p)) | static_cast<std::uint64_t>(load_le32(p + 4)) << 32;
+}
+
+// Entries of FAT12 are packed by 1.5 bytes, odd entry takes high nibble of the shared byte
+struct FAT12_traits {
+    static constexpr std::uint32_t ENTRY_BITS = 12;
+    static constexpr std::uint32_t FREE = 0x000;
+    static constexpr std::uint32_t CLASTER_MIN = 0x002;
+    static constexpr std::uint32_t CLASTER_MAX = 0xFEF;
+    static constexpr std::uint32_t BAD = 0xFF7;
+    static constexpr std::uint32_t EOC_MIN = 0xFF8;
+    static constexpr std::uint32_t EOC_MAX = 0xFFF;
+
+    static constexpr std::uint64_t entry_offset(std::uint32_t index) {
+        return index + index / 2;
+    }
+
+    static std::uint32_t load(unsigned char const* fat, std::uint32_t index) {
+        std::uint32_t value = load_le16(fat + entry_offset(index));
+        return (index & 1) ? value >> 4 : value & 0x0FFF;
+    }
+};
+
+struct FAT16_traits {
+    static constexpr std::uint32_t ENTRY_BITS = 16;
+    static constexpr std::uint32_t FREE = 0x0000;
+    static constexpr std::uint32_t CLASTER_MIN = 0x0002;
+    static constexpr std::uint32_t CLASTER_MAX = 0xFFEF;
+    static constexpr std::uint32_t BAD = 0xFFF7;
+    static constexpr std::uint32_t EOC_MIN = 0xFFF8;
+    static constexpr std::uint32_t EOC_MAX = 0xFFFF;
+
+    static constexpr std::uint64_t entry_offset(std::uint32_t index) {
+        return static_cast<std::uint64_t>(index) * 2;
+    }
+
+    static std::uint32_t load(unsigned char const* fat, std::uint32_t index) {
+        return load_le16(fat + entry_offset(index));
+    }
+};
+
+// High 4 bits of FAT32 entry are reserved and must be ignored
+struct FAT32_traits {
+    static constexpr std::uint32_t ENTRY_BITS = 32;
+    static constexpr std::uint32_t FREE = 0x00000000;
+    static constexpr std::uint32_t CLASTER_MIN = 0x00000002;
+    static constexpr std::uint32_t CLASTER_MAX = 0x0FFFFFEF;
+    static constexpr std::uint32_t BAD = 0x0FFFFFF7;
+    static constexpr std::uint32_t EOC_MIN = 0x0FFFFFF8;
+    static constexpr std::uint32_t EOC_MAX = 0x0FFFFFFF;
+
+    static constexpr std::uint64_t entry_offset(std::uint32_t index) {
+        return static_cast<std::uint64_t>(index) * 4;
+    }
+
+    static std::uint32_t load(unsigned char const* fat, std::uint32_t index) {
+        return load_le32(fat + entry_offset(index)) & 0x0FFFFFFF;
+    }
+};
+
+enum class Chain_status {
+    OK,
+    BAD_CLUSTER,
+    NOT_EOC,
+    LOOP,
+    STOPPED,
+};
+
+// Last claster index that is both addressable on disk and present in loaded FAT
+template <class Traits>
+std::uint32_t last_claster_index(std::string const& fat, std::uint32_t count_of_clusters) {
+    std::uint64_t fat_entries = static_cast<std::uint64_t>(fat.size()) * 8 / Traits::ENTRY_BITS;
+    if (fat_entries == 0) {
+        return 0;
+    }
+    return static_cast<std::uint32_t>(std::min<std::uint64_t>({Traits::CLASTER_MAX, count_of_clusters + 1ULL, fat_entries - 1}));
+}
+
+// Calls visit for every claster of chain starting at start, visit returns false to stop the walk.
+// end receives the value which stopped the walk
+template <class Traits, class Visit>
+Chain_status visit_claster_chain(std::string const& fat, std::uint32_t count_of_clusters, std::uint32_t start,
+                                 Visit &&visit, std::uint32_t& end) {
+    auto data = reinterpret_cast<unsigned char const*>(fat.data());
+    std::uint32_t const last = last_claster_index<Traits>(fat, count_of_clusters);
+    std::uint64_t length = 0;
+    std::uint32_t current = start;
+    while (Traits::CLASTER_MIN <= current && current <= last) {
+        if (length++ >= last) {
+            end = current;
+            return Chain_status::LOOP;
+        }
+        if (!visit(current)) {
+            end = current;
+            return Chain_status::STOPPED;
+        }
+        current = Traits::load(data, current);
+    }
+    end = current;
+    if (current == Traits::BAD) {
+        return Chain_status::BAD_CLUSTER;
+    }
+    if (!(Traits::EOC_MIN <= current && current <= Traits::EOC_MAX)) {
+        return Chain_status::NOT_EOC;
+    }
+    return Chain_status::OK;
+}
+
+// Appends chain starting at start to chain, end receives the value which stopped the walk
+template <class Traits>
+Chain_status walk_claster_chain(std::string const& fat, std::uint32_t count_of_clusters, std::uint32_t start,
+                                std::vector<std::uint32_t>& chain, std::uint32_t& end) {
+    return visit_claster_chain<Traits>(fat, count_of_clusters, start, [&](std::uint32_t claster) {
+        chain.push_back(claster);
+        return true;
+    }, end);
+}
+
+// Run of consecutive clasters on disk, file_claster is index of its first claster inside file
+struct Extent {
+    std::uint32_t first_claster = 0;
+    std::uint32_t length = 0;
+    std::uint64_t file_claster = 0;
+};
+
+// Same walk as walk_claster_chain, but consecutive clasters are merged into one extent
+template <class Traits>
+Chain_status walk_claster_extents(std::string const& fat, std::uint32_t count_of_clusters, std::uint32_t start,
+                                  std::vector<Extent>& extents, std::uint32_t& end) {
+    std::uint64_t index = 0;
+    return visit_claster_chain<Traits>(fat, count_of_clusters, start, [&](std::uint32_t claster) {
+        if (!extents.empty() && extents.back().first_claster + extents.back().length == claster) {
+            extents.back().length++;
+        } else {
+            extents.push_back({claster, 1, index});
+        }
+        index++;
+        return true;
+    }, end);
+}
+
+// Counts differing entries of two pieces of FAT which start at the same entry.
+// For FAT12 the pieces must start at byte offset divisible by 3 to keep entry parity
+template <class Traits>
+std::uint64_t count_differing_entries(std::string const& a, std::string const& b) {
+    std::uint64_t entries = static_cast<std::uint64_t>(std::min(a.size(), b.size())) * 8 / Traits::ENTRY_BITS;
+    auto data_a = reinterpret_cast<unsigned char const*>(a.data());
+    auto data_b = reinterpret_cast<unsigned char const*>(b.data());
+    std::uint64_t differing = 0;
+    for (std::uint32_t i = 0; i < entries; i++) {
+        differing += Traits::load(data_a, i) != Traits::load(data_b, i);
+    }
+    return differing;
+}
+
+}
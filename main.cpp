@@ -8,509 +8,313 @@
 #include <sstream>
 #include <algorithm>
 #include <cctype>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <cstdlib>
+
+#include "fat.h"
 
 const std::vector<std::string> find_mouth = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 
-std::string to_lower_case(std::string const&s) {
-    auto t = s;
-    for (int i = 0; i < s.size(); i++) {
-        t[i] = std::tolower(s[i]);
-    }
-    return t;
-}
+const std::size_t JOB_BUFFER_SIZE = 1 << 20;
+const std::size_t JOB_WORKERS = 2;
+const std::size_t JOB_BUFFERS = JOB_WORKERS * 2;
 
-unsigned int char_to_uint(char c) {
-    return static_cast<unsigned int>(static_cast<unsigned char>(c));
-}
+const std::uint64_t TEXT_CHUNK_SIZE = 1 << 16;
+const std::uint64_t DEFAULT_TEXT_LINES = 10;
 
-std::string remove_whitespace(std::string const& s) {
-    std::string result;
-    for (char c : s) {
-        if (!std::isspace(static_cast<unsigned char>(c))) {
-            result += c;
-        }
-    }
-    return result;
+volatile std::sig_atomic_t interrupted = 0;
+
+void on_interrupt(int) {
+    interrupted = 1;
 }
 
-std::string remove_char_from_str(std::string const&s, char d) {
-    std::string result;
-    for (char c : s) {
-        if (c != d) {
-            result += c;
+// Fixed set of transfer buffers, jobs block in acquire when all of them are in use
+class Buffer_pool {
+    std::mutex mutex;
+    std::condition_variable released;
+    std::vector<std::string> free_buffers;
+public:
+    Buffer_pool(std::size_t amount, std::size_t capacity) {
+        for (std::size_t i = 0; i < amount; i++) {
+            std::string buffer;
+            buffer.reserve(capacity);
+            free_buffers.push_back(std::move(buffer));
         }
     }
-    return result;
-}
-
 
-namespace FAT {
-const std::uint32_t MIN_SECTOR_SIZE = 512;
-const std::uint32_t BYTE = 256;
-const std::uint32_t WORD = BYTE * BYTE;
-const std::uint32_t DWORD = WORD * WORD;
-
-const std::uint32_t MULS[] = {1, BYTE, WORD, WORD * BYTE, DWORD, DWORD * BYTE, DWORD * WORD, DWORD * WORD * BYTE};
-std::uint64_t extract_with_endian(std::string const& s, int from, int amount, bool is_little_endian = true) {
-    std::uint64_t result = 0;
-    if (is_little_endian) {
-        for (int i = 0; i < amount; i++) {
-            result += static_cast<unsigned char>(s[from + i]) * MULS[i];
-        }
+    std::string acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [&] { return !free_buffers.empty(); });
+        std::string buffer = std::move(free_buffers.back());
+        free_buffers.pop_back();
+        buffer.clear();
+        return buffer;
     }
-    else {
-        for (int i = 0; i < amount; i++) {
-            result += static_cast<unsigned char>(s[from + i]) * MULS[amount - i - 1];
+
+    void release(std::string buffer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_buffers.push_back(std::move(buffer));
         }
+        released.notify_one();
     }
-    return result;
-}
-
-const std::uint32_t FAT32_FREE = 0x00000000;
-const std::uint32_t FAT32_CLASTER_MIN = 0x00000002;
-const std::uint32_t FAT32_CLASTER_MAX = 0x0FFFFFEF;
-const std::uint32_t FAT32_BAD = 0x0FFFFFF7;
-const std::uint32_t FAT32_EOC_MIN = 0x0FFFFFF8;
-const std::uint32_t FAT32_EOC_MAX = 0x0FFFFFFF;
-
-const std::uint32_t FAT16_FREE = 0x00000000;
-const std::uint32_t FAT16_CLASTER_MIN = 0x0002;
-const std::uint32_t FAT16_CLASTER_MAX = 0xFFEF;
-const std::uint32_t FAT16_BAD = 0xFFF7;
-const std::uint32_t FAT16_EOC_MIN = 0xFFF8;
-const std::uint32_t FAT16_EOC_MAX = 0xFFFF;
-
-enum FAT_TYPES {
-    NOT_FAT,
-    FAT12,
-    FAT16,
-    FAT32,
 };
 
-struct File_info {
-    std::string name = "";
-    std::string name_no_whitespace = "";
-    std::string long_name = "";
-    std::string long_name_lower = "";
-    std::uint_fast32_t attr = 0;
-    std::uint32_t low_claster_index = 0;
-    std::uint32_t high_claster_index = 0;
-    std::uint32_t claster_index = 0;
-    std::uint64_t size = 0;
-    std::uint32_t date_modify = 0;
-    std::uint32_t year_modify = 0;
-    std::uint32_t month_modify = 0;
-    std::uint32_t day_modify = 0;
-    std::uint32_t time_modify = 0;
-    std::uint32_t hour_modify = 0;
-    std::uint32_t minute_modify = 0;
-    std::uint32_t second_modify = 0;
-    std::uint32_t time_modified = 0;
-    bool is_folder = false;
-    bool is_deleted = false;
+enum class Job_state {
+    QUEUED,
+    RUNNING,
+    DONE,
+    FAILED,
+    CANCELLED,
 };
 
-File_info parse_file_info(std::string const& s, int offset) {
-    File_info file_info;
-    file_info.name = s.substr(offset, 11);
-    file_info.name_no_whitespace = remove_whitespace(file_info.name);
-    file_info.low_claster_index = extract_with_endian(s, offset + 0x1a, 2);
-    file_info.high_claster_index = extract_with_endian(s, offset + 0x14, 2);
-    file_info.size = extract_with_endian(s, offset + 0x1c, 4);
-    file_info.attr = extract_with_endian(s, offset + 0x0b, 1);
-    
-    file_info.date_modify = extract_with_endian(s, offset + 0x18, 2);
-    file_info.day_modify = file_info.date_modify & 0x1F;
-    file_info.month_modify = ((file_info.date_modify & 0x1e0) >> 5) - 1;
-    file_info.year_modify = ((file_info.date_modify & 0xfe00) >> 9) + 1980;
-
-    file_info.time_modify = extract_with_endian(s, offset + 0x16, 2);
-    file_info.second_modify = (file_info.date_modify & 0x1F) * 2;
-    file_info.minute_modify = ((file_info.date_modify & 0x7e0) >> 5);
-    file_info.hour_modify = ((file_info.date_modify & 0xf800) >> 11);
-
-    file_info.claster_index = file_info.low_claster_index + file_info.high_claster_index * WORD;
-    if (file_info.name[0] == static_cast<char>(0xe5)) {
-        file_info.is_deleted = true;
-    }
-    file_info.is_folder = static_cast<bool>(file_info.attr & 0x10);
-    return file_info;
-}
-
-struct LFN_chain {
-    std::string name_part = "";
-    std::uint32_t check_sum = 0;
-    std::uint32_t attr = 0;
+struct Job {
+    int id = 0;
+    std::string description = "";
+    FAT::File_handle file;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+    FILE* out = nullptr;
+    bool close_out = false;
+    bool background = false;
+
+    std::atomic<std::uint64_t> done{0};
+    std::atomic<bool> cancelled{false};
+    std::atomic<Job_state> state{Job_state::QUEUED};
+    std::chrono::steady_clock::time_point started;
+    std::string error = "";
 };
 
-LFN_chain parse_LFN(std::string const& s, int offset) {
-    LFN_chain lfn;
-    for (int i = 0; i < 10; i += 2) {
-        char c = s[offset + 0x01 + i];
-        if (c == char(0x00) || c == char(0xFF)) break;
-        lfn.name_part.push_back(c);
-    }
-    for (int i = 0; i < 12; i += 2) {
-        char c = s[offset + 0x0E + i];
-        if (c == char(0x00) || c == char(0xFF)) break;
-        lfn.name_part.push_back(c);
-    }            
-    for (int i = 0; i < 4; i += 2) {
-        char c = s[offset + 0x1C + i];
-        if (c == char(0x00) || c == char(0xFF)) break;
-        lfn.name_part.push_back(c);
-    }
-    lfn.check_sum = extract_with_endian(s, offset + 0x0d, 1);
-    lfn.attr = extract_with_endian(s, offset + 0x0b, 1);
-    return lfn;
-}
+class Job_manager {
+    Buffer_pool pool;
 
-struct Folder {
-    std::vector<std::string> path;
-    std::vector<File_info> files;
-    std::uint32_t max_size_len = 0;
-    std::uint32_t files_amount = 0;
-    std::uint32_t dirs_amount = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::shared_ptr<Job>> queue;
+    std::vector<std::shared_ptr<Job>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+    int next_id = 1;
 
-    std::uint32_t deleted_files_amount = 0;
-    std::uint32_t deleted_dirs_amount = 0;
-};
+    static bool is_finished(Job const& job) {
+        auto state = job.state.load();
+        return state == Job_state::DONE || state == Job_state::FAILED || state == Job_state::CANCELLED;
+    }
 
-class Disk {
-        FILE* fd = nullptr;
-        
-        FAT_TYPES fat_type = FAT_TYPES::NOT_FAT;
-
-        std::uint32_t SECTOR_SIZE = 0; 
-        std::uint32_t SECTOR_PER_CLASTER = 0; 
-        std::uint32_t RESERVED_SECTOR_AMOUNT = 0;
-        std::uint32_t FAT_TABLE_AMOUNT = 0;
-        std::uint32_t TOTAL_SECTOR_AMOUNT = 0;
-        std::uint32_t FAT_TABLE_SECTOR_AMOUNT = 0;
-        std::uint32_t ROOT_CATALOG_CLASTER_INDEX = 0;
-        std::uint32_t ROOT_ENTRIES = 0;
-        std::uint32_t ROOT_ENT_CNT = 0;
-
-        std::uint32_t BYTES_PER_CLASTER = 0;
-        std::uint32_t FAT_TABLE_SIZE = 0;
-        std::uint32_t FIRST_FAT_SECTOR = 0;
-        std::uint32_t FIRST_DATA_SECTOR = 0;
-        std::uint32_t FIRST_ROOT_DIR_SECTOR = 0;
-        std::uint32_t ROOT_DIR_SECTORS = 0;
-        std::uint32_t DATA_SECTORS = 0;
-        std::uint32_t COUNT_OF_CLUSTERS = 0;
-    
-        std::uint32_t FAT_FREE = 0;
-        std::uint32_t FAT_CLASTER_MIN = 0;
-        std::uint32_t FAT_CLASTER_MAX = 0;
-        std::uint32_t FAT_BAD = 0;
-        std::uint32_t FAT_EOC_MIN = 0;
-        std::uint32_t FAT_EOC_MAX = 0;
-        std::uint32_t FAT_INDEX_LEN = 0;
-    private:
-        void read_boot_sector() {
-            auto sector_info = read();
-
-            fat_type = FAT_TYPES::NOT_FAT;
-
-            SECTOR_SIZE = extract_with_endian(sector_info, 0x0b, 2);
-            SECTOR_PER_CLASTER = extract_with_endian(sector_info, 0x0d, 1);
-            RESERVED_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x0e, 2);
-            FAT_TABLE_AMOUNT = extract_with_endian(sector_info, 0x10, 1);
-            ROOT_ENTRIES = extract_with_endian(sector_info, 0x11, 2);
-
-            if (extract_with_endian(sector_info, 0x16, 2) == 0) {
-                FAT_TABLE_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x24, 4);
-            } else {
-                FAT_TABLE_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x16, 2);
-            }
-            if (extract_with_endian(sector_info, 0x13, 2) == 0) {
-                TOTAL_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x20, 4);
-            } else {
-                TOTAL_SECTOR_AMOUNT = extract_with_endian(sector_info, 0x13, 2);
+    void work() {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = queue.front();
+                queue.pop_front();
             }
-            
-            ROOT_CATALOG_CLASTER_INDEX = extract_with_endian(sector_info, 0x2c, 4);
-            ROOT_ENT_CNT = extract_with_endian(sector_info, 0x11, 2);
-            BYTES_PER_CLASTER = SECTOR_SIZE * SECTOR_PER_CLASTER;
-            FAT_TABLE_SIZE = FAT_TABLE_SECTOR_AMOUNT * SECTOR_SIZE;
-            FIRST_FAT_SECTOR = RESERVED_SECTOR_AMOUNT;
-            ROOT_DIR_SECTORS = ((ROOT_ENT_CNT * 32) + (SECTOR_SIZE - 1)) / SECTOR_SIZE;
-            FIRST_ROOT_DIR_SECTOR = FIRST_FAT_SECTOR + FAT_TABLE_AMOUNT * FAT_TABLE_SECTOR_AMOUNT;
-            FIRST_DATA_SECTOR = FIRST_ROOT_DIR_SECTOR + ROOT_DIR_SECTORS;
-            DATA_SECTORS = TOTAL_SECTOR_AMOUNT - FIRST_DATA_SECTOR;
-            COUNT_OF_CLUSTERS = DATA_SECTORS / SECTOR_PER_CLASTER;
-
-            if(COUNT_OF_CLUSTERS < 4085) {
-                std::cout << "FAT12" << std::endl;
-                std::cout << "WARNING! NOT SUPPORTED!" << std::endl;
-                fat_type = FAT_TYPES::FAT12;
-            } else if(COUNT_OF_CLUSTERS < 65525) {
-                std::cout << "FAT16" << std::endl;
-                fat_type = FAT_TYPES::FAT16;
-
-                FAT_FREE = FAT16_FREE;
-                FAT_CLASTER_MIN = FAT16_CLASTER_MIN;
-                FAT_CLASTER_MAX = FAT16_CLASTER_MAX;
-                FAT_BAD = FAT16_BAD;
-                FAT_EOC_MIN = FAT16_EOC_MIN;
-                FAT_EOC_MAX = FAT16_EOC_MAX;
-                FAT_INDEX_LEN = 2;
-            } else {
-                std::cout << "FAT32" << std::endl;
-                fat_type = FAT_TYPES::FAT32;
-
-                FAT_FREE = FAT32_FREE;
-                FAT_CLASTER_MIN = FAT32_CLASTER_MIN;
-                FAT_CLASTER_MAX = FAT32_CLASTER_MAX;
-                FAT_BAD = FAT32_BAD;
-                FAT_EOC_MIN = FAT32_EOC_MIN;
-                FAT_EOC_MAX = FAT32_EOC_MAX;
-                FAT_INDEX_LEN = 4;
-            }
-
-            std::cout << "Sector size " << SECTOR_SIZE << std::endl;
-            std::cout << "Sector per claster " << SECTOR_PER_CLASTER << std::endl;
-            std::cout << "RESERVED_SECTOR_AMOUNT " << RESERVED_SECTOR_AMOUNT << std::endl;
-            std::cout << "FAT_TABLE_AMOUNT " << FAT_TABLE_AMOUNT << std::endl;
-            std::cout << "TOTAL_SECTOR_AMOUNT " << TOTAL_SECTOR_AMOUNT << std::endl;
-            std::cout << "FAT_TABLE_SECTOR_AMOUNT " << FAT_TABLE_SECTOR_AMOUNT << std::endl;
-            std::cout << "ROOT_CATALOG_CLASTER_INDEX " << ROOT_CATALOG_CLASTER_INDEX << std::endl;
-            std::cout << "BYTES_PER_CLASTER " << BYTES_PER_CLASTER << std::endl;
-            std::cout << "FAT_TABLE_SIZE " << FAT_TABLE_SIZE << std::endl;
-            std::cout << "FIRST_FAT_SECTOR " << FIRST_FAT_SECTOR << std::endl;
-            std::cout << "FIRST_DATA_SECTOR " << FIRST_DATA_SECTOR << std::endl;
-            std::cout << "COUNT_OF_CLUSTERS " << COUNT_OF_CLUSTERS << std::endl;
-            std::cout << "FIRST_ROOT_DIR_SECTOR " << FIRST_ROOT_DIR_SECTOR << std::endl;
-        }
-
-        std::uint32_t get_next_claster_index(std::uint32_t current) {
-            if (current > COUNT_OF_CLUSTERS + 1 || current > FAT_CLASTER_MAX || current < FAT_CLASTER_MIN) {
-                throw std::string("Current claster index is out of range");
+            run(*job);
+            {
+                // Waiters check job state under mutex, taking it here keeps them from missing notify
+                std::lock_guard<std::mutex> lock(mutex);
             }
-
-            std::uint32_t byte_addres = FIRST_FAT_SECTOR * SECTOR_SIZE + (current) * FAT_INDEX_LEN;
-            std::string sector = read_sector(byte_addres / SECTOR_SIZE);
-            return extract_with_endian(sector, byte_addres % SECTOR_SIZE, FAT_INDEX_LEN);
+            changed.notify_all();
         }
+    }
 
-        std::vector<std::uint32_t> get_claster_chain(std::uint32_t start) {
-            std::uint32_t current = start;
-            std::vector<std::uint32_t> chain;
-            while (FAT_CLASTER_MIN <= current && current <= std::min(FAT_CLASTER_MAX, COUNT_OF_CLUSTERS + 1)) {
-                chain.push_back(current);
-                current = get_next_claster_index(current);
-            }
-            if (current == FAT_BAD) {
-                throw std::string("Chain of clusters end in bad cluster");
-            }
-            if (!(FAT_EOC_MIN <= current && current <= FAT_EOC_MAX)) {
-                std::cerr << "Bad Cluster index : 0x" << std::hex << current << std::dec << std::endl;
-                throw std::string("Chain of clusters end in not EOC cluster");
+    void run(Job &job) {
+        job.started = std::chrono::steady_clock::now();
+        job.state = Job_state::RUNNING;
+        try {
+            while (job.done < job.size && !job.cancelled) {
+                std::string buffer = pool.acquire();
+                try {
+                    job.file.read(job.offset + job.done, std::min<std::uint64_t>(JOB_BUFFER_SIZE, job.size - job.done), buffer);
+                } catch (...) {
+                    pool.release(std::move(buffer));
+                    throw;
+                }
+                std::size_t amount = buffer.size();
+                bool written = amount > 0 && fwrite(buffer.data(), 1, amount, job.out) == amount;
+                pool.release(std::move(buffer));
+                if (amount == 0) {
+                    throw std::string("Chain of clusters is shorter than file size");
+                }
+                if (!written) {
+                    throw std::string("Failed to write : ") + job.description;
+                }
+                job.done += amount;
             }
-            return chain;
-        }
-    public:
-        bool is_mounted() {
-            return fd != nullptr;
+        } catch (std::string err) {
+            job.error = err;
         }
-
-        void mount(std::string path) {
-            fd = fopen(path.c_str(), "rb");
-            if (!fd) {
-                throw std::string("Failed to mount disk : ") + path;
+        if (job.close_out) {
+            if (fclose(job.out) == EOF && job.error == "") {
+                job.error = "Failed to close file";
             }
-            read_boot_sector();
+        } else {
+            fflush(job.out);
         }
+        if (job.error != "") {
+            job.state = Job_state::FAILED;
+        } else if (job.done < job.size) {
+            job.state = Job_state::CANCELLED;
+        } else {
+            job.state = Job_state::DONE;
+        }
+    }
 
-        void unmount() {
-            if (!fd) return;
-
-            if (fclose(fd) == EOF) {
-                throw std::string("Failed to unmount disk");
+    static void print_job(Job const& job) {
+        static const char* STATE_NAMES[] = {"queued", "running", "done", "failed", "cancelled"};
+        double done_mib = job.done / 1048576.0, size_mib = job.size / 1048576.0;
+        printf("[%d] %-9s %s\t%.1f/%.1f MiB", job.id, STATE_NAMES[static_cast<int>(job.state.load())],
+               job.description.c_str(), done_mib, size_mib);
+        if (job.state == Job_state::RUNNING) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - job.started;
+            double speed = elapsed.count() > 0 ? done_mib / elapsed.count() : 0;
+            printf("\t%.1f MiB/s", speed);
+            if (speed > 0) {
+                printf("\tETA %.0fs", (size_mib - done_mib) / speed);
             }
-            fd = nullptr;
         }
-
-        FILE* get() {
-            return fd;
+        if (job.state == Job_state::FAILED) {
+            printf("\t%s", job.error.c_str());
         }
-
-        void seek(int position) {
-            if (fseek(fd, position, SEEK_SET)) {
-                throw std::string("Error in fseek") + std::to_string(position);
-            }
+        printf("\n");
+    }
+public:
+    Job_manager() : pool(JOB_BUFFERS, JOB_BUFFER_SIZE) {
+        for (std::size_t i = 0; i < JOB_WORKERS; i++) {
+            workers.emplace_back([this] { work(); });
         }
+    }
 
-        std::string continue_reading() {
-            char data[MIN_SECTOR_SIZE];
-
-            fread(data, MIN_SECTOR_SIZE, 1, fd);
-            if (ferror(fd)) {
-                throw std::string("Error in file reading");
+    // Streams size bytes of file starting at offset, size must not go beyond end of file
+    std::shared_ptr<Job> submit(std::string const& description, FAT::File_handle file, std::uint64_t offset, std::uint64_t size,
+                                FILE* out, bool close_out, bool background) {
+        auto job = std::make_shared<Job>();
+        job->description = description;
+        job->file = std::move(file);
+        job->offset = offset;
+        job->size = size;
+        job->out = out;
+        job->close_out = close_out;
+        job->background = background;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(job);
+            if (background) {
+                job->id = next_id++;
+                jobs.push_back(job);
             }
-
-            return std::string(data, MIN_SECTOR_SIZE);
         }
-
-        std::string read(int position = 0) {
-            seek(position);
-            return continue_reading();
+        changed.notify_all();
+        if (background) {
+            std::cout << "[" << job->id << "] " << description << std::endl;
         }
+        return job;
+    }
 
-        std::string read_sector(int sector_pos) {
-            seek(sector_pos * SECTOR_SIZE);
-            std::string answer;
-            for (int i = 0; i < SECTOR_SIZE / MIN_SECTOR_SIZE; i++) {
-                answer += continue_reading();
+    // Waits for foreground job, Ctrl+C cancels it instead of killing the whole manager
+    void wait(std::shared_ptr<Job> const& job) {
+        interrupted = 0;
+        auto previous = std::signal(SIGINT, on_interrupt);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!is_finished(*job)) {
+                changed.wait_for(lock, std::chrono::milliseconds(100));
+                if (interrupted) {
+                    job->cancelled = true;
+                }
             }
-            return answer;
         }
-
-        std::string read_cluster(int cluster_pos) {
-            seek(((cluster_pos - 2) * SECTOR_PER_CLASTER + FIRST_DATA_SECTOR) * SECTOR_SIZE);
-            std::string answer;
-            for (int i = 0; i < (SECTOR_SIZE * SECTOR_PER_CLASTER) / MIN_SECTOR_SIZE; i++) {
-                answer += continue_reading();
-            }
-            return answer;
+        std::signal(SIGINT, previous);
+        if (job->state == Job_state::FAILED) {
+            throw job->error;
+        }
+        if (job->state == Job_state::CANCELLED) {
+            std::cout << "Interrupted : " << job->description << std::endl;
         }
+    }
 
-        Folder parse_folder(std::uint32_t first_cluster, std::vector<std::string> previous_path, std::string next="") {
-            if (first_cluster == 0) {
-                first_cluster = ROOT_CATALOG_CLASTER_INDEX;
+    // Ctrl+C while waiting cancels every unfinished job, like it does for foreground transfer in wait
+    void wait_all() {
+        auto all_finished = [&] {
+            return queue.empty() && std::all_of(jobs.begin(), jobs.end(), [](auto const& job) { return is_finished(*job); });
+        };
+        interrupted = 0;
+        auto previous = std::signal(SIGINT, on_interrupt);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!all_finished()) {
+                std::cout << "Waiting for background jobs to finish, Ctrl+C cancels them" << std::endl;
             }
-
-            Folder folder;
-            std::string LFN = "";
-
-            auto chain = get_claster_chain(first_cluster);
-
-            for (std::uint32_t cluster_index = 0; cluster_index < chain.size(); cluster_index++) {
-                auto data = read_cluster(chain[cluster_index]);
-                for (int i = 0; i < data.size(); i+=32) {
-                    if (extract_with_endian(data, i, 1) == 0x0) {
-                        continue; // все же тут break или continue???
-                    }
-                    File_info file = parse_file_info(data, i);
-                    if (file.attr == 0x0f) {
-                        LFN_chain lfn = parse_LFN(data, i);
-                        LFN = lfn.name_part + LFN;
-                        continue;
+            while (!all_finished()) {
+                changed.wait_for(lock, std::chrono::milliseconds(100));
+                if (interrupted) {
+                    for (auto const& job : jobs) {
+                        job->cancelled = true;
                     }
-                    file.long_name += LFN;
-                    file.long_name_lower = to_lower_case(file.long_name);
-                    if (LFN != "") {
+                    for (auto const& job : queue) {
+                        job->cancelled = true;
                     }
-                    LFN = "";
-                    folder.files.push_back(file);
                 }
             }
-            if (next != "")
-                previous_path.push_back(next);
-            folder.path = previous_path;
-            config_folder(folder);
-            return folder;
         }
+        std::signal(SIGINT, previous);
+    }
 
-        Folder parse_root_folder() {
-            if (fat_type == FAT_TYPES::FAT32) {
-                return parse_folder(0, {});
-            }
-            Folder folder;
-            std::string LFN = "";
-            for (int pos = FIRST_ROOT_DIR_SECTOR; pos < ROOT_DIR_SECTORS + FIRST_ROOT_DIR_SECTOR; pos++) {
-                auto data = read_sector(pos);
-                for (int i = 0; i < data.size(); i+=32) {
-                    if (extract_with_endian(data, i, 1) == 0x0) {
-                        continue; // все же тут break или continue???
-                    }
-                    File_info file = parse_file_info(data, i);
-                    if (file.attr == 0x0f) {
-                        LFN_chain lfn = parse_LFN(data, i);
-                        LFN = lfn.name_part + LFN;
-                        continue;
-                    }
-                    file.long_name += LFN;
-                    file.long_name_lower = to_lower_case(file.long_name);
-                    LFN = "";
-                    folder.files.push_back(file);
-                }
+    bool cancel(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto const& job : jobs) {
+            if (job->id == id && !is_finished(*job)) {
+                job->cancelled = true;
+                return true;
             }
-
-            config_folder(folder);
-            return folder;
         }
+        return false;
+    }
 
-        void get_file(std::uint32_t first_claster, std::string &destination) {
-            auto chain = get_claster_chain(first_claster);
-            destination = "";
-            for (int i = 0; i < chain.size(); i++) {
-                destination += read_cluster(chain[i]);
-            }
+    void print_jobs() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto const& job : jobs) {
+            print_job(*job);
         }
+    }
 
-        static std::string get_file_show_name(File_info const& file) {
-            if (file.long_name != "") {
-                return file.long_name;
-            }
-            std::string name = file.name.substr(0, 8), ext = file.name.substr(8);
-            if (file.is_deleted) {
-                name[0] = '?';
-            }
-            name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
-            ext.erase(std::remove(ext.begin(), ext.end(), ' '), ext.end());
-            if (ext != "") {
-                ext = "." + ext;
-            }
-            return name + ext;
-        }
-
-        static bool cmp_files_name(File_info const&a, File_info const&b) {
-            return to_lower_case(get_file_show_name(a)) < to_lower_case(get_file_show_name(b));
-        }
-
-        void config_folder(Folder & folder) {
-            std::sort(folder.files.begin(), folder.files.end(), cmp_files_name);
-            std::uint64_t max_size = 0;
-            for (auto file : folder.files) {
-                max_size = std::max(max_size, file.size);
-                if (file.is_folder) {
-                    if (!file.is_deleted)
-                        folder.dirs_amount ++;
-                    else
-                        folder.deleted_dirs_amount++;
-                } else {
-                    if (!file.is_deleted)
-                        folder.files_amount ++;
-                    else
-                        folder.deleted_files_amount++;
-                }
-            }
-            folder.max_size_len = 1;
-            std::uint64_t mul = 1;
-            while (mul < max_size) {
-                mul *= 10;
-                folder.max_size_len ++;
+    // Prints background jobs finished since previous call and forgets them
+    void report_finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto const& job : jobs) {
+            if (is_finished(*job)) {
+                print_job(*job);
             }
         }
+        jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](auto const& job) { return is_finished(*job); }), jobs.end());
+    }
 
-        ~Disk() {
-            try {
-                unmount();
-            } catch (std::string err) {
-                std::cerr << err << std::endl;
-            } catch (...) {
-                std::cerr << "Some unknown error in Disk destructor occured" << std::endl;
-            }
+    ~Job_manager() {
+        wait_all();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
-    };
-}
+        changed.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+};
 
 
 class Terminal {
     FAT::Folder current_folder, root_folder, temp_folder;
     FAT::Disk disk;
+    Job_manager jobs;
 public:
     void mount(std::string path) {
         disk.mount(path);
@@ -519,6 +323,7 @@ public:
     }
 
     void unmount() {
+        jobs.wait_all();
         disk.unmount();
         current_folder = FAT::Folder();
     }
@@ -536,12 +341,24 @@ public:
     }
 
     bool find_name(FAT::Folder const& folder, std::string const& find_name, bool is_long_name, FAT::File_info &file_req, bool show_deleted) {
-        for (auto file : folder.files) {
-            if (!show_deleted && file.is_deleted) continue;
-            if (file.long_name_lower == find_name && is_long_name || file.name_no_whitespace == find_name && !is_long_name) {
-                file_req = file;
+        if (is_long_name) {
+            // Files are sorted by name_key in config_folder
+            FAT::File_info key;
+            key.name_key = find_name;
+            auto range = std::equal_range(folder.files.begin(), folder.files.end(), key, FAT::Disk::cmp_files_name);
+            for (auto it = range.first; it != range.second; it++) {
+                if (!show_deleted && it->is_deleted) continue;
+                file_req = *it;
                 return true;
             }
+        } else {
+            for (auto const& file : folder.files) {
+                if (!show_deleted && file.is_deleted) continue;
+                if (file.name_no_whitespace == find_name) {
+                    file_req = file;
+                    return true;
+                }
+            }
         }
         file_req = FAT::File_info();
         return false;
@@ -620,32 +437,136 @@ public:
         }
     }
 
-    void open_file(std::string const& path, std::string &destination, bool show_deleted) {
+    bool find_file(std::string const& path, FAT::File_info &file, bool show_deleted) {
         FAT::Folder folder;
         std::string file_name;
 
         if (path.find('/') != std::string::npos) {
             if (!go_to_folder(path.substr(0, path.find_last_of('/')), current_folder, folder, show_deleted))
-                return;
+                return false;
             file_name = path.substr(path.find_last_of('/') + 1);
         } else {
             folder = current_folder;
             file_name = path;
         }
-        FAT::File_info file;
         if (!find_file_in_folder(folder, file_name, file, show_deleted)) {
             std::cout << "There is no such file : " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Reads number right after name in config, e.g. 20 in "-n20". Value is left as is when option
+    // is absent, false is returned only for option without number and caller reports it
+    static bool parse_number_option(std::string const& config, std::string const& name, std::uint64_t &value) {
+        auto pos = config.find(name);
+        if (pos == std::string::npos)
+            return true;
+        char const* begin = config.c_str() + pos + name.size();
+        if (!std::isdigit(static_cast<unsigned char>(*begin))) {
+            return false;
+        }
+        value = std::strtoull(begin, nullptr, 10);
+        return true;
+    }
+
+    void cat(std::string const& path, std::string const& config, bool background) {
+        bool show_deleted = (config.find("d") != std::string::npos);
+        FAT::File_info file;
+        if (!find_file(path, file, show_deleted))
             return;
+        auto handle = disk.open_file(file);
+        std::uint64_t offset = 0, length = handle.size();
+        auto range = config.find("--range=");
+        if (range != std::string::npos) {
+            auto colon = config.find(':', range);
+            if (!parse_number_option(config, "--range=", offset) || colon == std::string::npos ||
+                !parse_number_option(config.substr(colon), ":", length)) {
+                std::cout << "Range must look like --range=OFFSET:LENGTH" << std::endl;
+                return;
+            }
+        }
+        offset = std::min(offset, handle.size());
+        length = std::min(length, handle.size() - offset);
+        auto job = jobs.submit("cat " + path, std::move(handle), offset, length, stdout, false, background);
+        if (!background) {
+            jobs.wait(job);
+            std::cout << std::endl << std::endl;
         }
-        disk.get_file(file.claster_index, destination);
-        destination.erase(destination.begin() + file.size, destination.end());
     }
 
-    void cat(std::string const& path, std::string const& config) {
+    // Common start of head and tail: usage, -nN and file lookup
+    bool open_lines_file(std::string const& command, std::vector<std::string> const& paths, std::string const& config,
+                         FAT::File_handle &handle, std::uint64_t &lines) {
+        if (paths.empty()) {
+            std::cout << "Usage : " << command << " [file] -nN" << std::endl;
+            return false;
+        }
+        lines = DEFAULT_TEXT_LINES;
+        if (!parse_number_option(config, "-n", lines)) {
+            std::cout << "Bad value of option -n" << std::endl;
+            return false;
+        }
         bool show_deleted = (config.find("d") != std::string::npos);
-        std::string file_data;
-        open_file(path, file_data, show_deleted);
-        std::cout << file_data << std::endl << std::endl;
+        FAT::File_info file;
+        if (!find_file(paths[0], file, show_deleted))
+            return false;
+        handle = disk.open_file(file);
+        return true;
+    }
+
+    // Reads file forward chunk by chunk until lines newlines are found
+    void head(std::vector<std::string> const& paths, std::string const& config) {
+        FAT::File_handle handle;
+        std::uint64_t lines = 0;
+        if (!open_lines_file("head", paths, config, handle, lines))
+            return;
+        std::uint64_t offset = 0;
+        while (lines > 0 && offset < handle.size()) {
+            std::string chunk = handle.read(offset, TEXT_CHUNK_SIZE);
+            std::size_t end = 0;
+            while (lines > 0 && end < chunk.size()) {
+                auto newline = chunk.find('\n', end);
+                end = newline == std::string::npos ? chunk.size() : newline + 1;
+                lines -= newline != std::string::npos;
+            }
+            fwrite(chunk.data(), 1, end, stdout);
+            offset += chunk.size();
+        }
+        fflush(stdout);
+        std::cout << std::endl;
+    }
+
+    // Reads file backward chunk by chunk from the end, so only clusters of printed lines are touched
+    void tail(std::vector<std::string> const& paths, std::string const& config) {
+        FAT::File_handle handle;
+        std::uint64_t lines = 0;
+        if (!open_lines_file("tail", paths, config, handle, lines))
+            return;
+        std::uint64_t end = handle.size(), start = end;
+        bool found = lines == 0;
+        while (!found && start > 0) {
+            std::uint64_t from = start > TEXT_CHUNK_SIZE ? start - TEXT_CHUNK_SIZE : 0;
+            std::string chunk = handle.read(from, start - from);
+            for (std::size_t i = chunk.size(); i-- > 0;) {
+                // Newline which ends the last line does not start a new one
+                if (chunk[i] != '\n' || from + i + 1 == end)
+                    continue;
+                if (--lines == 0) {
+                    start = from + i + 1;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                start = from;
+        }
+        for (std::uint64_t offset = start; offset < end; offset += TEXT_CHUNK_SIZE) {
+            std::string chunk = handle.read(offset, TEXT_CHUNK_SIZE);
+            fwrite(chunk.data(), 1, chunk.size(), stdout);
+        }
+        fflush(stdout);
+        std::cout << std::endl;
     }
 
     void ls(std::string const&config) {
@@ -723,8 +644,7 @@ public:
         for (auto file : folder.files) {
             if (file.is_folder) {
                 if (file.name_no_whitespace == "." || file.name_no_whitespace == "..") continue;
-                auto sub_folder = disk.parse_folder(file.claster_index, {});
-                sz += count_size(sub_folder);
+                sz += count_size(*disk.get_folder(file.claster_index));
             } else {
                 sz += file.size;
             }
@@ -739,20 +659,98 @@ public:
         return count_size(folder);
     }
 
-    void copy(std::string const& source, std::string const& destination, std::string const& config) {
+    // Failed snapshot leaves mounted disk usable, so error is reported instead of ending the session
+    void snapshot() {
+        try {
+            disk.save_snapshot(disk.get_image_path() + FAT::SNAPSHOT_EXT);
+        } catch (std::string err) {
+            std::cout << err << std::endl;
+        }
+    }
+
+    void copy(std::string const& source, std::string const& destination, std::string const& config, bool background) {
         bool show_deleted = (config.find("d") != std::string::npos);
-        std::string file_data;
-        open_file(source, file_data, show_deleted);
+        FAT::File_info file;
+        if (!find_file(source, file, show_deleted))
+            return;
+        auto handle = disk.open_file(file);
         auto fd = fopen(destination.c_str(), "wb+");
         if (!fd) {
             throw std::string("Failed to open file : " + destination);
         }
 
-        fwrite(file_data.c_str(), file_data.size(), 1, fd);
-        if (fclose(fd) == EOF) {
-            throw std::string("Failed to close file : " + destination);
+        auto job = jobs.submit("cp " + source + " " + destination, std::move(handle), 0, file.size, fd, true, background);
+        if (!background) {
+            jobs.wait(job);
+        }
+    }
+
+    void check() {
+        disk.check();
+    }
+
+    // Parses YYYY-MM-DD[THH:MM:SS] into FAT stamp, date without time is start or end of the day.
+    // FAT keeps seconds / 2, so odd seconds round down for the end of range and up for its start.
+    // 59 seconds of start become 30 in 5 bit field, which is past every stamp of that minute
+    // and before the next one, so no carry is needed
+    static bool parse_time_stamp(std::string const& text, bool is_end, std::uint32_t &stamp) {
+        unsigned year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+        int date_len = 0, time_len = 0;
+        bool good = sscanf(text.c_str(), "%4u-%2u-%2u%n", &year, &month, &day, &date_len) == 3;
+        if (good && static_cast<std::size_t>(date_len) == text.size()) {
+            if (is_end) {
+                hour = 23;
+                minute = 59;
+                second = 59;
+            }
+        } else {
+            good = good && sscanf(text.c_str() + date_len, "T%2u:%2u:%2u%n", &hour, &minute, &second, &time_len) == 3 &&
+                   static_cast<std::size_t>(date_len + time_len) == text.size();
+        }
+        if (!good || year < 1980 || year > 2107 || month < 1 || month > 12 || day < 1 || day > 31 ||
+            hour > 23 || minute > 59 || second > 59) {
+            std::cout << "Time must look like YYYY-MM-DD[THH:MM:SS] : " << text << std::endl;
+            return false;
+        }
+        stamp = FAT::pack_time_stamp((year - 1980) << 9 | month << 5 | day, hour << 11 | minute << 5 | (is_end ? second : second + 1) / 2);
+        return true;
+    }
+
+    void modified(std::vector<std::string> const& paths) {
+        if (paths.empty()) {
+            std::cout << "Usage : modified FROM [TO]" << std::endl;
+            return;
+        }
+        std::uint32_t from = 0, to = UINT32_MAX;
+        if (!parse_time_stamp(paths[0], false, from) || (paths.size() > 1 && !parse_time_stamp(paths[1], true, to)))
+            return;
+        auto index = disk.get_time_index();
+        auto [first, last] = index->find_range(from, to);
+        for (std::size_t row = last; row-- > first;) {
+            std::uint32_t date = index->stamps[row] >> 16, time = index->stamps[row] & 0xFFFF;
+            printf("%04u-%02u-%02u %02u:%02u:%02u %12llu %s\n", (date >> 9) + 1980, (date >> 5) & 0x0F, date & 0x1F,
+                   time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2,
+                   static_cast<unsigned long long>(index->sizes[row]), index->get_path(row).c_str());
+        }
+        fflush(stdout);
+        std::cout << last - first << " of " << index->stamps.size() << " entries modified in range" << std::endl;
+    }
+
+    void print_jobs() {
+        jobs.print_jobs();
+    }
+
+    void kill(std::string const& id) {
+        char* end = nullptr;
+        long job_id = std::strtol(id.c_str(), &end, 10);
+        if (id == "" || *end != '\0' || !jobs.cancel(job_id)) {
+            std::cout << "No such running job : " << id << std::endl;
         }
     }
+
+    void report_jobs() {
+        jobs.report_finished();
+    }
 };
 
 
@@ -762,7 +760,7 @@ int main() {
         Terminal terminal;
         std::string command;
         std::set <std::string> commands_inside_disk = {"unmount",
-            "pwd", "ls", "dir", "cd", "size", "cat", "cp", "copy"};
+            "pwd", "ls", "dir", "cd", "size", "cat", "cp", "copy", "snapshot", "jobs", "kill", "check", "head", "tail", "modified"};
 
         while(should_work) {
             std::string temp, config, prev;
@@ -784,6 +782,11 @@ int main() {
                 paths.push_back(temp);
                 prev = "";
             }
+            bool background = !paths.empty() && paths.back() == "&";
+            if (background) {
+                paths.pop_back();
+            }
+            terminal.report_jobs();
             if (command == "help") {
                 std::cout << "This FAT manager is created by Misha Tuzov AI360" << std::endl;
                 std::cout << "Here is list of cammands: " << std::endl;
@@ -796,8 +799,14 @@ int main() {
                 std::cout << "7) dir /x /d (deleted files)" << std::endl;
                 std::cout << "8) cd [path] -d (go in deleted)" << std::endl;
                 std::cout << "9) size [path]" << std::endl;
-                std::cout << "10) cat [file] -d (deleted files)" << std::endl;
-                std::cout << "11) copy|cp [source] [destination] -d (deleted files)" << std::endl;
+                std::cout << "10) cat [file] -d (deleted files) --range=OFFSET:LENGTH (bytes) [&] (run in background)" << std::endl;
+                std::cout << "11) copy|cp [source] [destination] -d (deleted files) [&] (run in background)" << std::endl;
+                std::cout << "12) snapshot (save metadata to [image].fatsnap, next mount of the image maps it)" << std::endl;
+                std::cout << "13) jobs (background transfers with throughput and ETA)" << std::endl;
+                std::cout << "14) kill [job] (cancel background transfer)" << std::endl;
+                std::cout << "15) check (cross-links, lost and looped chains, size and FAT copy mismatches)" << std::endl;
+                std::cout << "16) head|tail [file] -nN (first or last N lines, default 10) -d (deleted files)" << std::endl;
+                std::cout << "17) modified [from] [to] (YYYY-MM-DD[THH:MM:SS], newest first, index is kept until unmount)" << std::endl;
             } else if (command == "exit" || command == "2") {
                 should_work = false;
                 break;
@@ -825,9 +834,23 @@ int main() {
                     if (result != -1)
                         std::cout << "Size of folder " << paths[0] << " : " << result << " bytes" << std::endl;
                 } else if (command == "cat") {
-                    terminal.cat(paths[0], config);
+                    terminal.cat(paths[0], config, background);
                 } else if (command == "copy" || command == "cp") {
-                    terminal.copy(paths[0], paths[1], config);
+                    terminal.copy(paths[0], paths[1], config, background);
+                } else if (command == "snapshot") {
+                    terminal.snapshot();
+                } else if (command == "jobs") {
+                    terminal.print_jobs();
+                } else if (command == "kill") {
+                    terminal.kill(paths.empty() ? "" : paths[0]);
+                } else if (command == "check") {
+                    terminal.check();
+                } else if (command == "head") {
+                    terminal.head(paths, config);
+                } else if (command == "tail") {
+                    terminal.tail(paths, config);
+                } else if (command == "modified") {
+                    terminal.modified(paths);
                 }
             } else {
                 std::cout << "No such command : " << command << std::endl;